@@ -1201,6 +1201,8 @@ static int param_parse( x264_param_t *p, const char *name, const char *value )
     }
     OPT("sliced-threads")
         p->b_sliced_threads = atobool(value);
+    OPT("sliced-frames")
+        p->i_sliced_frames = atoi(value);
     OPT("sync-lookahead")
     {
         if( !strcasecmp(value, "auto") )
@@ -1208,6 +1210,12 @@ static int param_parse( x264_param_t *p, const char *name, const char *value )
         else
             p->i_sync_lookahead = atoi(value);
     }
+    OPT("entropy-thread")
+        p->b_entropy_thread = atobool(value);
+    OPT("filter-thread")
+        p->b_filter_thread = atobool(value);
+    OPT("lookahead-only")
+        p->b_lookahead_only = atobool(value);
     OPT2("deterministic", "n-deterministic")
         p->b_deterministic = atobool(value);
     OPT("cpu-independent")
@@ -1298,6 +1306,8 @@ static int param_parse( x264_param_t *p, const char *name, const char *value )
             p->i_scenecut_threshold = atoi(value);
         }
     }
+    OPT("scenecut-prefilter")
+        p->b_scenecut_prefilter = atobool(value);
     OPT("intra-refresh")
         p->b_intra_refresh = atobool(value);
     OPT("bframes")
@@ -1478,6 +1488,8 @@ static int param_parse( x264_param_t *p, const char *name, const char *value )
         p->analyse.i_mv_range = atoi(value);
     OPT2("mvrange-thread", "mv-range-thread")
         p->analyse.i_mv_range_thread = atoi(value);
+    OPT("hash-me")
+        p->analyse.b_hash_me = atobool(value);
     OPT2("subme", "subq")
         p->analyse.i_subpel_refine = atoi(value);
     OPT("psy-rd")
@@ -1506,6 +1518,16 @@ static int param_parse( x264_param_t *p, const char *name, const char *value )
         p->analyse.i_trellis = atoi(value);
     OPT("fast-pskip")
         p->analyse.b_fast_pskip = atobool(value);
+    OPT("static-skip")
+        p->analyse.b_static_skip = atobool(value);
+    OPT("dup-skip")
+        p->analyse.i_dup_skip = atoi(value);
+    OPT("partition-model")
+        p->analyse.b_partition_model = atobool(value);
+    OPT("intra-gradient")
+        p->analyse.i_intra_gradient = atoi(value);
+    OPT("partition-log")
+        p->analyse.psz_partition_log = strdup(value);
     OPT("dct-decimate")
         p->analyse.b_dct_decimate = atobool(value);
     OPT("deadzone-inter")
@@ -1533,6 +1555,10 @@ static int param_parse( x264_param_t *p, const char *name, const char *value )
         p->rc.f_rf_constant_max = atof(value);
     OPT("rc-lookahead")
         p->rc.i_lookahead = atoi(value);
+    OPT("incremental-lookahead")
+        p->rc.i_incremental_lookahead = atoi(value);
+    OPT("coarse-lookahead")
+        p->rc.b_coarse_lookahead = atobool(value);
     OPT2("qpmin", "qp-min")
     {
         if( 3 == sscanf( value, "%d:%d:%d", &p->rc.i_qp_min[SLICE_TYPE_I], &p->rc.i_qp_min[SLICE_TYPE_P], &p->rc.i_qp_min[SLICE_TYPE_B] ) ||
@@ -1739,16 +1765,32 @@ char *x264_param2string( x264_param_t *p, int b_res )
         s += sprintf( s, " psy_rd=%.2f:%.2f", p->analyse.f_psy_rd, p->analyse.f_psy_trellis );
     s += sprintf( s, " mixed_ref=%d", p->analyse.b_mixed_references );
     s += sprintf( s, " me_range=%d", p->analyse.i_me_range );
+    if( p->analyse.b_hash_me )
+        s += sprintf( s, " hash_me=%d", p->analyse.b_hash_me );
     s += sprintf( s, " chroma_me=%d", p->analyse.b_chroma_me );
     s += sprintf( s, " trellis=%d", p->analyse.i_trellis );
     s += sprintf( s, " 8x8dct=%d", p->analyse.b_transform_8x8 );
     s += sprintf( s, " cqm=%d", p->i_cqm_preset );
     s += sprintf( s, " deadzone=%d,%d", p->analyse.i_luma_deadzone[0], p->analyse.i_luma_deadzone[1] );
     s += sprintf( s, " fast_pskip=%d", p->analyse.b_fast_pskip );
+    if( p->analyse.b_static_skip )
+        s += sprintf( s, " static_skip=%d", p->analyse.b_static_skip );
+    if( p->analyse.i_dup_skip )
+        s += sprintf( s, " dup_skip=%d", p->analyse.i_dup_skip );
+    if( p->analyse.b_partition_model )
+        s += sprintf( s, " partition_model=%d", p->analyse.b_partition_model );
+    if( p->analyse.i_intra_gradient )
+        s += sprintf( s, " intra_gradient=%d", p->analyse.i_intra_gradient );
     s += sprintf( s, " chroma_qp_offset=%d", p->analyse.i_chroma_qp_offset );
     s += sprintf( s, " threads=%d", p->i_threads );
     s += sprintf( s, " lookahead_threads=%d", p->i_lookahead_threads );
     s += sprintf( s, " sliced_threads=%d", p->b_sliced_threads );
+    if( p->b_sliced_threads && p->i_sliced_frames > 1 )
+        s += sprintf( s, " sliced_frames=%d", p->i_sliced_frames );
+    if( p->b_entropy_thread )
+        s += sprintf( s, " entropy_thread=%d", p->b_entropy_thread );
+    if( p->b_filter_thread )
+        s += sprintf( s, " filter_thread=%d", p->b_filter_thread );
     if( p->i_slice_count )
         s += sprintf( s, " slices=%d", p->i_slice_count );
     if( p->i_slice_count_max )
@@ -1784,9 +1826,15 @@ char *x264_param2string( x264_param_t *p, int b_res )
         s += sprintf( s, " keyint=%d", p->i_keyint_max );
     s += sprintf( s, " keyint_min=%d scenecut=%d intra_refresh=%d",
                   p->i_keyint_min, p->i_scenecut_threshold, p->b_intra_refresh );
+    if( p->b_scenecut_prefilter )
+        s += sprintf( s, " scenecut_prefilter=%d", p->b_scenecut_prefilter );
+    if( p->rc.b_coarse_lookahead )
+        s += sprintf( s, " coarse_lookahead=%d", p->rc.b_coarse_lookahead );
 
     if( p->rc.b_mb_tree || p->rc.i_vbv_buffer_size )
         s += sprintf( s, " rc_lookahead=%d", p->rc.i_lookahead );
+    if( p->rc.i_incremental_lookahead )
+        s += sprintf( s, " incremental_lookahead=%d", p->rc.i_incremental_lookahead );
 
     s += sprintf( s, " rc=%s mbtree=%d", p->rc.i_rc_method == X264_RC_ABR ?
                                ( p->rc.b_stat_read ? "2pass" : p->rc.i_vbv_max_bitrate == p->rc.i_bitrate ? "cbr" : "abr" )
@@ -127,6 +127,10 @@ enum sei_payload_type_e
 #define X264_LOOKAHEAD_THREAD_MAX 16
 #define X264_LOOKAHEAD_MAX 250
 
+// number of macroblock rows the entropy thread may trail analysis by.
+// RD uses the CABAC contexts from 2 rows back, so at least 3 are needed to keep both sides busy.
+#define X264_ENTROPY_ROWS 4
+
 // number of pixels (per thread) in progress at any given time.
 // 16 for the macroblock in progress + 3 for deblocking + 3 for motion compensation filter + 2 for extra safety
 #define X264_THREAD_HEIGHT 24
@@ -65,6 +65,9 @@
 
 #define NALU_OVERHEAD 5 // startcode + NAL type costs 5 bytes per frame
 #define FILLER_OVERHEAD (NALU_OVERHEAD+1)
+/* esa and tesa need the integral image and the fullpel mv cost tables */
+#define ME_EXHAUSTIVE(method) ((method) == X264_ME_ESA || (method) == X264_ME_TESA)
+
 #define SEI_OVERHEAD (NALU_OVERHEAD - (h->param.b_annexb && !h->param.i_avcintra_class && (h->out.i_nal-1)))
 
 #if HAVE_INTERLACED
@@ -220,12 +223,95 @@ typedef struct x264_lookahead_t
     int                           i_last_keyframe;
     int                           i_slicetype_length;
     x264_frame_t                  *last_nonb;
+    int                           i_mbtree_sweep; /* incremental mbtree: the frame to resume passing changes back from, -1 for the end */
     x264_pthread_t                thread_handle;
     x264_sync_frame_list_t        ifbuf;
     x264_sync_frame_list_t        next;
     x264_sync_frame_list_t        ofbuf;
 } x264_lookahead_t;
 
+/* Everything x264_macroblock_write_cabac needs to know about one macroblock,
+ * captured by the analysis thread so the entropy thread can code it later. */
+typedef struct
+{
+    int8_t   i_type;
+    int8_t   i_partition;
+    uint8_t  i_sub_partition[4];
+    int8_t   i_cbp_luma;
+    int8_t   i_cbp_chroma;
+    int8_t   b_transform_8x8;
+    int8_t   i_intra16x16_pred_mode;
+    int8_t   i_chroma_pred_mode;
+    int8_t   i_qp;
+    int8_t   i_last_qp;
+    int8_t   i_last_dqp;
+    int      i_mb_x;
+    int      i_mb_y;
+
+    unsigned int i_neighbour;
+    int      i_mb_type_top;
+    int      i_mb_type_left[2];
+    int      i_mb_prev_xy;
+    int      i_mb_left_xy[2];
+    int      i_mb_top_xy;
+
+    int      i_neighbour_transform_size;
+    int      i_neighbour_skip;
+    int      i_cbp_top;
+    int      i_cbp_left;
+    ALIGNED_16( int8_t intra4x4_pred_mode[X264_SCAN8_LUMA_SIZE] );
+    ALIGNED_8( uint8_t non_zero_count[X264_SCAN8_SIZE] );
+    ALIGNED_4( int8_t ref[2][X264_SCAN8_LUMA_SIZE] );
+    ALIGNED_16( int16_t mv[2][X264_SCAN8_LUMA_SIZE][2] );
+    ALIGNED_8( uint8_t mvd[2][X264_SCAN8_LUMA_SIZE][2] );
+    ALIGNED_4( int8_t skip[X264_SCAN8_LUMA_SIZE] );
+
+    /* only the blocks that will actually be coded are filled in */
+    ALIGNED_64( dctcoef luma16x16_dc[3][16] );
+    ALIGNED_16( dctcoef chroma_dc[2][8] );
+    ALIGNED_64( dctcoef luma8x8[12][64] ); /* also holds the samples of I_PCM macroblocks */
+    ALIGNED_64( dctcoef luma4x4[16*3][16] );
+} x264_entropy_mb_t;
+
+typedef struct x264_entropy_t
+{
+    x264_t                  *h;             /* private context the entropy thread codes with */
+    x264_pthread_t          thread_handle;
+    x264_pthread_mutex_t    mutex;
+    x264_pthread_cond_t     cv_fill;        /* signaled when records are queued or on exit */
+    x264_pthread_cond_t     cv_empty;       /* signaled when records or rows are done */
+    int                     b_thread_active;
+    int                     b_exit_thread;
+    int                     b_error;
+    int                     i_size;         /* number of records in the ring */
+    int                     i_write;        /* records queued in the current slice */
+    int                     i_read;         /* records coded in the current slice */
+    int                     i_row_done;     /* last row fully coded in the current slice, -1 if none */
+    x264_entropy_mb_t       *mb;
+    int                     *row_bits;
+    uint8_t                 (*row_state)[1024]; /* CABAC contexts at the end of each row, [X264_ENTROPY_ROWS] */
+} x264_entropy_t;
+
+typedef struct
+{
+    FILE                    *fh;
+    x264_pthread_mutex_t    mutex;          /* lines are written from every slice and frame thread */
+} x264_partition_log_t;
+
+typedef struct x264_filter_thread_t
+{
+    x264_t                  *h;             /* private context the filter thread deblocks with */
+    x264_pthread_t          thread_handle;
+    x264_pthread_mutex_t    mutex;
+    x264_pthread_cond_t     cv_fill;        /* signaled when rows are queued or on exit */
+    x264_pthread_cond_t     cv_empty;       /* signaled when rows are done */
+    int                     b_thread_active;
+    int                     b_exit_thread;
+    int                     i_row_next;     /* next fdec_filter_row() call to make, -1 if none queued yet */
+    int                     i_row_end;      /* rows queued so far, exclusive */
+    void                    *scratch_buffer;
+} x264_filter_thread_t;
+
 typedef struct x264_ratecontrol_t   x264_ratecontrol_t;
 
 typedef struct x264_left_table_t
@@ -259,6 +345,8 @@ typedef struct
     int i_mb_field[3];
     /* Adaptive direct mv pred */
     int i_direct_score[2];
+    /* Whole-mb rd evaluations, and how many of them the rd cache answered */
+    int i_rd_cache[2];
     /* Metrics */
     int64_t i_ssd[3];
     double f_ssim;
@@ -272,6 +360,7 @@ struct x264_t
 
     x264_t          *thread[X264_THREAD_MAX+1];
     x264_t          *lookahead_thread[X264_LOOKAHEAD_THREAD_MAX];
+    x264_t          *slice_thread[X264_THREAD_MAX]; /* contexts encoding this frame's slices; [0] is this one */
     int             b_thread_active;
     int             i_thread_phase; /* which thread to use for the next frame */
     int             i_thread_idx;   /* which thread this is */
@@ -300,6 +389,8 @@ struct x264_t
     x264_t          *reconfig_h;
     int             reconfig;
 
+    x264_partition_log_t *partition_log; /* mb decisions for training the partition model */
+
     /**** thread synchronization starts here ****/
 
     /* frame number/poc */
@@ -307,7 +398,9 @@ struct x264_t
     int             i_frame_num;
 
     int             i_thread_frames; /* Number of different frames being encoded by threads;
-                                      * 1 when sliced-threads is on. */
+                                      * 1 when sliced-threads is on, unless sliced-frames is too. */
+    int             i_slice_threads; /* Number of threads encoding the slices of each frame */
+    int             b_mv_range_thread_auto; /* choose mv_range_thread per frame from lookahead motion */
     int             i_nal_type;
     int             i_nal_ref_idc;
 
@@ -400,6 +493,7 @@ struct x264_t
         int64_t i_largest_pts;
         int64_t i_second_largest_pts;
         int b_have_lowres;  /* Whether 1/2 resolution luma planes are being used */
+        int b_have_coarse;  /* Whether 1/4 resolution luma planes are being used for frametype decisions */
         int b_have_sub8x8_esa;
     } frames;
 
@@ -606,6 +700,42 @@ struct x264_t
             int     i_stride[3];
         } pic;
 
+        /* luma cost of the subpel candidates already tried in this mb, see me.c */
+#define MC_CACHE_BITS 6
+        struct
+        {
+            uint32_t i_gen;
+            struct
+            {
+                uint32_t i_gen;
+                uint32_t mv;
+                pixel *p_fref;
+                const x264_weight_t *weight;
+                int i_pixel;
+                int cost;
+            } entry[1<<MC_CACHE_BITS];
+        } mc_cache;
+
+        /* rd cost of the inter mb configurations already encoded in this mb, see rdo.c */
+#define RD_CACHE_BITS 4
+#define RD_CACHE_KEY 43
+        struct
+        {
+            uint32_t i_gen;
+            struct
+            {
+                uint32_t i_gen;
+                uint32_t key[RD_CACHE_KEY];
+                int cost;
+                /* what the encode leaves behind for later rd calls */
+                int cbp;
+                int i_cbp_luma;
+                int i_cbp_chroma;
+                ALIGNED_8( uint8_t non_zero_count[X264_SCAN8_SIZE] );
+                ALIGNED_8( uint8_t mvd[2][X264_SCAN8_LUMA_SIZE][2] );
+            } entry[1<<RD_CACHE_BITS];
+        } rd_cache;
+
         /* cache */
         struct
         {
@@ -703,6 +833,7 @@ struct x264_t
         int64_t i_mb_cbp[6];
         int64_t i_mb_pred_mode[4][13];
         int64_t i_mb_field[3];
+        int64_t i_rd_cache[2];
         /* */
         int     i_direct_score[2];
         int     i_direct_frames[2];
@@ -752,6 +883,8 @@ struct x264_t
     x264_bitstream_function_t bsf;
 
     x264_lookahead_t *lookahead;
+    x264_entropy_t   *entropy;
+    x264_filter_thread_t *filter;
 
 #if HAVE_OPENCL
     x264_opencl_t opencl;
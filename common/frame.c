@@ -126,6 +126,9 @@ static x264_frame_t *frame_new( x264_t *h, int b_fdec )
     frame->i_width_lowres = frame->i_width[0]/2;
     frame->i_lines_lowres = frame->i_lines[0]/2;
     frame->i_stride_lowres = align_stride( frame->i_width_lowres + 2*PADH, align, disalign<<1 );
+    frame->i_width_coarse = frame->i_width_lowres/2;
+    frame->i_lines_coarse = frame->i_lines_lowres/2;
+    frame->i_stride_coarse = align_stride( frame->i_width_coarse + 2*PADH, align, disalign<<2 );
 
     for( int i = 0; i < h->param.i_bframe + 2; i++ )
         for( int j = 0; j < h->param.i_bframe + 2; j++ )
@@ -202,11 +205,17 @@ static x264_frame_t *frame_new( x264_t *h, int b_fdec )
         PREALLOC( frame->i_row_bits, i_lines/16 * sizeof(int) );
         PREALLOC( frame->f_row_qp, i_lines/16 * sizeof(float) );
         PREALLOC( frame->f_row_qscale, i_lines/16 * sizeof(float) );
-        if( h->param.analyse.i_me_method >= X264_ME_ESA )
+        if( ME_EXHAUSTIVE( h->param.analyse.i_me_method ) )
             PREALLOC( frame->buffer[3], frame->i_stride[0] * (frame->i_lines[0] + 2*i_padv) * sizeof(uint16_t) << h->frames.b_have_sub8x8_esa );
+        if( h->param.analyse.b_hash_me )
+        {
+            PREALLOC( frame->hash_head, (1 << HASH_ME_BITS) * sizeof(int32_t) );
+            PREALLOC( frame->hash_next, i_width * i_lines * sizeof(int32_t) );
+            PREALLOC( frame->hash_key, i_width * i_lines * sizeof(uint32_t) );
+        }
         if( PARAM_INTERLACED )
             PREALLOC( frame->field, i_mb_count * sizeof(uint8_t) );
-        if( h->param.analyse.b_mb_info )
+        if( h->param.analyse.b_mb_info || h->param.analyse.b_static_skip || h->param.analyse.i_dup_skip )
             PREALLOC( frame->effective_qp, i_mb_count * sizeof(uint8_t) );
     }
     else /* fenc frame */
@@ -224,10 +233,31 @@ static x264_frame_t *frame_new( x264_t *h, int b_fdec )
                     PREALLOC( frame->lowres_mv_costs[j][i], h->mb.i_mb_count*sizeof(int) );
                 }
             PREALLOC( frame->i_propagate_cost, i_mb_count * sizeof(uint16_t) );
+            if( h->param.rc.i_incremental_lookahead )
+                PREALLOC( frame->i_propagate_sent, i_mb_count * sizeof(uint16_t) );
             for( int j = 0; j <= h->param.i_bframe+1; j++ )
                 for( int i = 0; i <= h->param.i_bframe+1; i++ )
                     PREALLOC( frame->lowres_costs[j][i], i_mb_count * sizeof(uint16_t) );
 
+            if( h->frames.b_have_coarse )
+            {
+                int coarse_plane_size = align_plane_size( frame->i_stride_coarse * (frame->i_lines_coarse + 2*PADV), disalign );
+                int coarse_count = ((frame->i_width_coarse+7)>>3) * ((frame->i_lines_coarse+7)>>3);
+
+                PREALLOC( frame->buffer_lowres[1], 4 * coarse_plane_size * sizeof(pixel) );
+                for( int j = 0; j <= !!h->param.i_bframe; j++ )
+                    for( int i = 0; i <= h->param.i_bframe; i++ )
+                    {
+                        PREALLOC( frame->coarse_mvs[j][i], 2*coarse_count*sizeof(int16_t) );
+                        PREALLOC( frame->coarse_mv_costs[j][i], coarse_count*sizeof(int) );
+                    }
+                PREALLOC( frame->i_coarse_intra_cost, coarse_count*sizeof(int) );
+            }
+            if( h->param.b_scenecut_prefilter )
+                PREALLOC( frame->i_lowres_dc, i_mb_count * sizeof(uint16_t) );
+            if( h->param.analyse.b_static_skip || h->param.analyse.i_dup_skip )
+                PREALLOC( frame->static_mb, i_mb_count * sizeof(uint8_t) );
+
             /* mbtree asm can overread the input buffers, make sure we don't read outside of allocated memory. */
             prealloc_size += NATIVE_ALIGN;
         }
@@ -275,8 +305,10 @@ static x264_frame_t *frame_new( x264_t *h, int b_fdec )
         M32( frame->mv16x16[0] ) = 0;
         frame->mv16x16++;
 
-        if( h->param.analyse.i_me_method >= X264_ME_ESA )
+        if( ME_EXHAUSTIVE( h->param.analyse.i_me_method ) )
             frame->integral = (uint16_t*)frame->buffer[3] + frame->i_stride[0] * i_padv + PADH;
+        if( frame->hash_head )
+            memset( frame->hash_head, -1, (1 << HASH_ME_BITS) * sizeof(int32_t) );
     }
     else
     {
@@ -293,6 +325,13 @@ static x264_frame_t *frame_new( x264_t *h, int b_fdec )
             frame->i_intra_cost = frame->lowres_costs[0][0];
             memset( frame->i_intra_cost, -1, (i_mb_count+3) * sizeof(uint16_t) );
 
+            if( h->frames.b_have_coarse )
+            {
+                int coarse_plane_size = align_plane_size( frame->i_stride_coarse * (frame->i_lines_coarse + 2*PADV), disalign );
+                for( int i = 0; i < 4; i++ )
+                    frame->coarse[i] = frame->buffer_lowres[1] + (frame->i_stride_coarse * PADV + PADH) + i * coarse_plane_size;
+            }
+
             if( h->param.rc.i_aq_mode )
                 /* shouldn't really be initialized, just silences a valgrind false-positive in x264_mbtree_propagate_cost_sse2 */
                 memset( frame->i_inv_qscale_factor, 0, (h->mb.i_mb_count+3) * sizeof(uint16_t) );
@@ -633,6 +672,12 @@ void x264_frame_expand_border_lowres( x264_frame_t *frame )
         plane_expand_border( frame->lowres[i], frame->i_stride_lowres, frame->i_width_lowres, frame->i_lines_lowres, PADH, PADV, 1, 1, 0 );
 }
 
+void x264_frame_expand_border_coarse( x264_frame_t *frame )
+{
+    for( int i = 0; i < 4; i++ )
+        plane_expand_border( frame->coarse[i], frame->i_stride_coarse, frame->i_width_coarse, frame->i_lines_coarse, PADH, PADV, 1, 1, 0 );
+}
+
 void x264_frame_expand_border_chroma( x264_t *h, x264_frame_t *frame, int plane )
 {
     int v_shift = CHROMA_V_SHIFT;
@@ -683,6 +728,63 @@ void x264_expand_border_mbpair( x264_t *h, int mb_x, int mb_y )
 }
 
 /* threading */
+/* Hash the 8x8 block at every position of the source picture of frame, and chain the
+ * positions by hash bucket.  The reconstruction is never an exact copy, so exact matches
+ * have to be looked for in the source.  Flat blocks match everywhere around themselves,
+ * so the regular search finds them without help and they are left out. */
+void x264_frame_hash_init( x264_frame_t *frame, x264_frame_t *src )
+{
+    int stride = src->i_stride[0];
+    int width = frame->i_width[0];
+    int lines = frame->i_lines[0];
+    uint32_t *row = (uint32_t*)frame->hash_next;
+    uint32_t *key = frame->hash_key;
+    uint32_t mul_x8 = 1, mul_y8 = 1, flat_x = 0, flat_y = 0;
+    for( int i = 0; i < 8; i++ )
+    {
+        mul_x8 *= HASH_ME_MUL_X;
+        mul_y8 *= HASH_ME_MUL_Y;
+        flat_x = flat_x * HASH_ME_MUL_X + 1;
+        flat_y = flat_y * HASH_ME_MUL_Y + 1;
+    }
+
+    /* 8 pixels wide, reusing hash_next until the chains are built */
+    for( int y = 0; y < lines; y++ )
+    {
+        pixel *pix = src->plane[0] + y*stride;
+        uint32_t *r = row + y*width;
+        uint32_t sum = 0;
+        for( int x = 0; x < 8; x++ )
+            sum = sum * HASH_ME_MUL_X + pix[x];
+        r[0] = sum;
+        for( int x = 1; x <= width-8; x++ )
+            r[x] = sum = sum * HASH_ME_MUL_X - pix[x-1] * mul_x8 + pix[x+7];
+    }
+    /* 8 rows tall */
+    for( int x = 0; x <= width-8; x++ )
+    {
+        uint32_t sum = 0;
+        for( int y = 0; y < 8; y++ )
+            sum = sum * HASH_ME_MUL_Y + row[y*width+x];
+        key[x] = sum;
+    }
+    for( int y = 1; y <= lines-8; y++ )
+        for( int x = 0; x <= width-8; x++ )
+            key[y*width+x] = key[(y-1)*width+x] * HASH_ME_MUL_Y - row[(y-1)*width+x] * mul_y8 + row[(y+7)*width+x];
+
+    memset( frame->hash_head, -1, (1 << HASH_ME_BITS) * sizeof(int32_t) );
+    for( int y = 0; y <= lines-8; y++ )
+        for( int x = 0; x <= width-8; x++ )
+        {
+            int pos = y*width + x;
+            if( key[pos] == flat_x * flat_y * src->plane[0][y*stride+x] )
+                continue;
+            int bucket = key[pos] >> (32 - HASH_ME_BITS);
+            frame->hash_next[pos] = frame->hash_head[bucket];
+            frame->hash_head[bucket] = pos;
+        }
+}
+
 void x264_frame_cond_broadcast( x264_frame_t *frame, int i_lines_completed )
 {
     x264_pthread_mutex_lock( &frame->mutex );
@@ -793,7 +895,9 @@ x264_frame_t *x264_frame_pop_unused( x264_t *h, int b_fdec )
     frame->b_scenecut = 1;
     frame->b_keyframe = 0;
     frame->b_corrupt = 0;
-    frame->i_slice_count = h->param.b_sliced_threads ? h->param.i_threads : 1;
+    frame->i_static_ref[0] = -1;
+    frame->i_duplicate = 0;
+    frame->i_slice_count = h->param.b_sliced_threads ? h->i_slice_threads : 1;
 
     memset( frame->weight, 0, sizeof(frame->weight) );
     memset( frame->f_weighted_cost_delta, 0, sizeof(frame->f_weighted_cost_delta) );
@@ -32,6 +32,12 @@
 #define PADH 32
 #define PADV 32
 
+/* hash-me: the 8x8 block at every position of a reference is hashed with a polynomial
+ * that rolls one pixel at a time, first along rows and then down columns */
+#define HASH_ME_BITS 18
+#define HASH_ME_MUL_X 0x9E3779B1U
+#define HASH_ME_MUL_Y 0x85EBCA77U
+
 typedef struct x264_frame
 {
     /* */
@@ -75,12 +81,19 @@ typedef struct x264_frame
     int     i_stride_lowres;
     int     i_width_lowres;
     int     i_lines_lowres;
+    int     i_stride_coarse;
+    int     i_width_coarse;
+    int     i_lines_coarse;
     pixel *plane[3];
     pixel *plane_fld[3];
     pixel *filtered[3][4]; /* plane[0], H, V, HV */
     pixel *filtered_fld[3][4];
     pixel *lowres[4]; /* half-size copy of input frame: Orig, H, V, HV */
+    pixel *coarse[4]; /* quarter-size copy for the coarse lookahead: Orig, H, V, HV */
     uint16_t *integral;
+    int32_t *hash_head; /* hash-me: first position in each bucket of 8x8 block hashes, -1 if empty */
+    int32_t *hash_next; /* next position in the same bucket */
+    uint32_t *hash_key; /* hash of the 8x8 block at each position */
 
     /* for unrestricted mv we allocate more data than needed
      * allocated data are stored in buffer */
@@ -101,6 +114,9 @@ typedef struct x264_frame
     int16_t (*lowres_mvs[2][X264_BFRAME_MAX+1])[2];
     uint8_t *field;
     uint8_t *effective_qp;
+    uint8_t *static_mb; /* lookahead: mbs that are static relative to the frames i_static_ref[] */
+    int     i_static_ref[2];
+    int     i_duplicate; /* lookahead: 1 if identical to the frames i_static_ref[], 2 if nearly so */
 
     /* Stored as (lists_used << LOWRES_COST_SHIFT) + (cost).
      * Doesn't need special addressing for intra cost because
@@ -120,8 +136,11 @@ typedef struct x264_frame
      * FIXME: how big an array do we need? */
     int     i_cost_est[X264_BFRAME_MAX+2][X264_BFRAME_MAX+2];
     int     i_cost_est_aq[X264_BFRAME_MAX+2][X264_BFRAME_MAX+2];
+    int     i_cost_recalc[2][X264_BFRAME_MAX+2][X264_BFRAME_MAX+2]; // i_cost_est adjusted by the mbtree quantizers, as P and as B
     int     i_satd; // the i_cost_est of the selected frametype
     int     i_intra_mbs[X264_BFRAME_MAX+2];
+    int     i_decided_cost; // lookahead-only mode: the i_cost_est of the selected frametype
+    float   f_decided_intra_mbs; // and the fraction of its blocks that were coded intra
     int     *i_row_satds[X264_BFRAME_MAX+2][X264_BFRAME_MAX+2];
     int     *i_row_satd;
     int     *i_row_bits;
@@ -131,7 +150,25 @@ typedef struct x264_frame
     float   *f_qp_offset_aq;
     int     b_intra_calculated;
     uint16_t *i_intra_cost;
+
+    /* The same for the quarter-size plane, which only feeds frametype decisions.
+     * Each 8x8 block of it covers 2x2 lowres blocks. */
+    int16_t (*coarse_mvs[2][X264_BFRAME_MAX+1])[2];
+    int     *coarse_mv_costs[2][X264_BFRAME_MAX+1];
+    int     i_coarse_cost[X264_BFRAME_MAX+2][X264_BFRAME_MAX+2];
+    int     *i_coarse_intra_cost;
+
+    /* Scenecut prefilter: histograms of the lowres luma and of the chroma at half
+     * resolution, and the pixel sum of each lowres 8x8 block. */
+    uint32_t i_luma_hist[32];
+    uint32_t i_chroma_hist[2][16];
+    uint16_t *i_lowres_dc;
+
     uint16_t *i_propagate_cost;
+    /* Incremental mbtree: the part of i_propagate_cost already passed on to the references,
+     * and the frame numbers of those references (-1 if nothing was passed on yet). */
+    uint16_t *i_propagate_sent;
+    int     i_mbtree_ref[2];
     uint16_t *i_inv_qscale_factor;
     int     b_scenecut; /* Set to zero if the frame cannot possibly be part of a real scenecut. */
     float   f_weighted_cost_delta[X264_BFRAME_MAX+2];
@@ -151,6 +188,7 @@ typedef struct x264_frame
     /* threading */
     int     i_lines_completed; /* in pixels */
     int     i_lines_weighted; /* FIXME: this only supports weighting of one reference frame */
+    int     i_mv_range_thread; /* how far below the current row motion search may reach into the refs */
     int     i_reference_count; /* number of threads using this frame (not necessarily the number of pointers) */
     x264_pthread_mutex_t mutex;
     x264_pthread_cond_t  cv;
@@ -228,6 +266,8 @@ void          x264_frame_expand_border( x264_t *h, x264_frame_t *frame, int mb_y
 void          x264_frame_expand_border_filtered( x264_t *h, x264_frame_t *frame, int mb_y, int b_end );
 #define x264_frame_expand_border_lowres x264_template(frame_expand_border_lowres)
 void          x264_frame_expand_border_lowres( x264_frame_t *frame );
+#define x264_frame_expand_border_coarse x264_template(frame_expand_border_coarse)
+void          x264_frame_expand_border_coarse( x264_frame_t *frame );
 #define x264_frame_expand_border_chroma x264_template(frame_expand_border_chroma)
 void          x264_frame_expand_border_chroma( x264_t *h, x264_frame_t *frame, int plane );
 #define x264_frame_expand_border_mod16 x264_template(frame_expand_border_mod16)
@@ -242,6 +282,8 @@ void          x264_macroblock_deblock( x264_t *h );
 
 #define x264_frame_filter x264_template(frame_filter)
 void          x264_frame_filter( x264_t *h, x264_frame_t *frame, int mb_y, int b_end );
+#define x264_frame_hash_init x264_template(frame_hash_init)
+void          x264_frame_hash_init( x264_frame_t *frame, x264_frame_t *src );
 #define x264_frame_init_lowres x264_template(frame_init_lowres)
 void          x264_frame_init_lowres( x264_t *h, x264_frame_t *frame );
 
@@ -291,4 +333,17 @@ void          x264_sync_frame_list_push( x264_sync_frame_list_t *slist, x264_fra
 #define x264_sync_frame_list_pop x264_template(sync_frame_list_pop)
 x264_frame_t *x264_sync_frame_list_pop( x264_sync_frame_list_t *slist );
 
+static ALWAYS_INLINE uint32_t x264_frame_hash_block( pixel *pix, intptr_t stride )
+{
+    uint32_t key = 0;
+    for( int y = 0; y < 8; y++, pix += stride )
+    {
+        uint32_t row = 0;
+        for( int x = 0; x < 8; x++ )
+            row = row * HASH_ME_MUL_X + pix[x];
+        key = key * HASH_ME_MUL_Y + row;
+    }
+    return key;
+}
+
 #endif
@@ -366,11 +366,14 @@ int x264_macroblock_thread_allocate( x264_t *h, int b_lookahead )
             {
                 /* Only allocate the first one, and allocate it for the whole frame, because we
                  * won't be deblocking until after the frame is fully encoded. */
-                if( h == h->thread[0] && !i )
+                if( h == h->slice_thread[0] && !i )
                     CHECKED_MALLOC( h->deblock_strength[0], sizeof(**h->deblock_strength) * h->mb.i_mb_count );
                 else
-                    h->deblock_strength[i] = h->thread[0]->deblock_strength[0];
+                    h->deblock_strength[i] = h->slice_thread[0]->deblock_strength[0];
             }
+            else if( h->param.b_filter_thread )
+                /* The filter thread can trail by any number of rows. */
+                CHECKED_MALLOC( h->deblock_strength[i], sizeof(**h->deblock_strength) * h->mb.i_mb_count );
             else
                 CHECKED_MALLOC( h->deblock_strength[i], sizeof(**h->deblock_strength) * h->mb.i_mb_width );
             h->deblock_strength[1] = h->deblock_strength[i];
@@ -384,18 +387,21 @@ int x264_macroblock_thread_allocate( x264_t *h, int b_lookahead )
         int buf_hpel = (h->thread[0]->fdec->i_width[0]+48+32) * sizeof(int16_t);
         int buf_ssim = h->param.analyse.b_ssim * 8 * (h->param.i_width/4+3) * sizeof(int);
         int me_range = X264_MIN(h->param.analyse.i_me_range, h->param.analyse.i_mv_range);
-        int buf_tesa = (h->param.analyse.i_me_method >= X264_ME_ESA) *
+        int buf_tesa = ME_EXHAUSTIVE( h->param.analyse.i_me_method ) *
             ((me_range*2+24) * sizeof(int16_t) + (me_range+4) * (me_range+1) * 4 * sizeof(mvsad_t));
         scratch_size = X264_MAX3( buf_hpel, buf_ssim, buf_tesa );
     }
     int buf_mbtree = h->param.rc.b_mb_tree * ((h->mb.i_mb_width+15)&~15) * sizeof(int16_t);
-    scratch_size = X264_MAX( scratch_size, buf_mbtree );
+    /* Lookahead threads accumulate the propagate costs of their rows into both references
+     * in buffers of their own, behind the propagate amounts. */
+    int buf_propagate = b_lookahead && h->param.i_lookahead_threads > 1 ? 2 * h->mb.i_mb_count * sizeof(uint16_t) : 0;
+    scratch_size = X264_MAX( scratch_size, buf_mbtree + h->param.rc.b_mb_tree * buf_propagate );
     if( scratch_size )
         CHECKED_MALLOC( h->scratch_buffer, scratch_size );
     else
         h->scratch_buffer = NULL;
 
-    int buf_lookahead_threads = (h->mb.i_mb_height + (4 + 32) * h->param.i_lookahead_threads) * sizeof(int) * 2;
+    int buf_lookahead_threads = (h->mb.i_mb_height + 4 + 32) * h->param.i_lookahead_threads * sizeof(int) * 2;
     int buf_mbtree2 = buf_mbtree * 12; /* size of the internal propagate_list asm buffer */
     scratch_size = X264_MAX( buf_lookahead_threads, buf_mbtree2 );
     CHECKED_MALLOC( h->scratch_buffer2, scratch_size );
@@ -410,7 +416,7 @@ void x264_macroblock_thread_free( x264_t *h, int b_lookahead )
     if( !b_lookahead )
     {
         for( int i = 0; i <= PARAM_INTERLACED; i++ )
-            if( !h->param.b_sliced_threads || (h == h->thread[0] && !i) )
+            if( !h->param.b_sliced_threads || (h == h->slice_thread[0] && !i) )
                 x264_free( h->deblock_strength[i] );
         for( int i = 0; i < (PARAM_INTERLACED ? 5 : 2); i++ )
             for( int j = 0; j < (CHROMA444 ? 3 : 2); j++ )
@@ -504,6 +510,12 @@ void x264_macroblock_thread_init( x264_t *h )
     h->mb.i_subpel_refine = h->param.analyse.i_subpel_refine;
     if( h->sh.i_type == SLICE_TYPE_B && (h->mb.i_subpel_refine == 6 || h->mb.i_subpel_refine == 8) )
         h->mb.i_subpel_refine--;
+    /* Near-duplicate frames get a quick search: they barely differ from their references. */
+    if( h->fenc->i_duplicate == 2 )
+    {
+        h->mb.i_me_method = X264_ME_DIA;
+        h->mb.i_subpel_refine = X264_MIN( h->mb.i_subpel_refine, 2 );
+    }
     h->mb.b_chroma_me = h->param.analyse.b_chroma_me &&
                         ((h->sh.i_type == SLICE_TYPE_P && h->mb.i_subpel_refine >= 5) ||
                          (h->sh.i_type == SLICE_TYPE_B && h->mb.i_subpel_refine >= 9));
@@ -869,7 +881,7 @@ static void ALWAYS_INLINE macroblock_cache_load( x264_t *h, int mb_x, int mb_y,
 
     const x264_left_table_t *left_index_table = h->mb.left_index_table;
 
-    h->mb.cache.deblock_strength = h->deblock_strength[mb_y&1][h->param.b_sliced_threads?h->mb.i_mb_xy:mb_x];
+    h->mb.cache.deblock_strength = h->deblock_strength[mb_y&1][h->param.b_sliced_threads||h->param.b_filter_thread?h->mb.i_mb_xy:mb_x];
 
     /* load cache */
     if( h->mb.i_neighbour & MB_TOP )
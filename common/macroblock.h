@@ -362,6 +362,12 @@ int x264_mb_predict_mv_direct16x16( x264_t *h, int *b_changed );
  *      h->mb. need only valid values from other blocks */
 #define x264_mb_predict_mv_ref16x16 x264_template(mb_predict_mv_ref16x16)
 void x264_mb_predict_mv_ref16x16( x264_t *h, int i_list, int i_ref, int16_t mvc[8][2], int *i_mvc );
+/* x264_mb_predict_mv_lowres:
+ *      set mv to the lookahead's 16x16 mv for this ref, scaled from the longest
+ *      distance the lookahead searched if the ref is further away.
+ *      returns 0 if the lookahead has none. */
+#define x264_mb_predict_mv_lowres x264_template(mb_predict_mv_lowres)
+int x264_mb_predict_mv_lowres( x264_t *h, int i_list, int i_ref, int16_t mv[2] );
 
 #define x264_mb_mc x264_template(mb_mc)
 void x264_mb_mc( x264_t *h );
@@ -452,6 +452,51 @@ static void integral_init8v( uint16_t *sum8, intptr_t stride )
         sum8[x] = sum8[x+8*stride] - sum8[x];
 }
 
+/* Histograms and 8x8 block sums of a frame, for the scenecut prefilter.
+ * Luma is taken from the lowres plane, chroma from every other sample of every other row. */
+static void frame_init_scenecut_stats( x264_t *h, x264_frame_t *frame )
+{
+    memset( frame->i_luma_hist, 0, sizeof(frame->i_luma_hist) );
+    memset( frame->i_chroma_hist, 0, sizeof(frame->i_chroma_hist) );
+    memset( frame->i_lowres_dc, 0, h->mb.i_mb_count * sizeof(uint16_t) );
+
+    for( int y = 0; y < frame->i_lines_lowres; y++ )
+    {
+        pixel *src = frame->lowres[0] + y * frame->i_stride_lowres;
+        uint16_t *dc = frame->i_lowres_dc + (y>>3) * h->mb.i_mb_width;
+        for( int x = 0; x < frame->i_width_lowres; x++ )
+        {
+            frame->i_luma_hist[src[x] >> (BIT_DEPTH-5)]++;
+            dc[x>>3] += src[x];
+        }
+    }
+
+    if( CHROMA_FORMAT == CHROMA_400 )
+        return;
+    if( CHROMA444 )
+    {
+        for( int p = 0; p < 2; p++ )
+            for( int y = 0; y < frame->i_lines[p+1]; y += 2 )
+            {
+                pixel *src = frame->plane[p+1] + y * frame->i_stride[p+1];
+                for( int x = 0; x < frame->i_width[p+1]; x += 2 )
+                    frame->i_chroma_hist[p][src[x] >> (BIT_DEPTH-4)]++;
+            }
+    }
+    else
+    {
+        for( int y = 0; y < frame->i_lines[1]; y += 2 )
+        {
+            pixel *src = frame->plane[1] + y * frame->i_stride[1];
+            for( int x = 0; x < frame->i_width[1]; x += 2 )
+            {
+                frame->i_chroma_hist[0][src[2*x]   >> (BIT_DEPTH-4)]++;
+                frame->i_chroma_hist[1][src[2*x+1] >> (BIT_DEPTH-4)]++;
+            }
+        }
+    }
+}
+
 void x264_frame_init_lowres( x264_t *h, x264_frame_t *frame )
 {
     pixel *src = frame->plane[0];
@@ -468,6 +513,12 @@ void x264_frame_init_lowres( x264_t *h, x264_frame_t *frame )
     x264_frame_expand_border_lowres( frame );
 
     memset( frame->i_cost_est, -1, sizeof(frame->i_cost_est) );
+    memset( frame->i_cost_recalc, -1, sizeof(frame->i_cost_recalc) );
+    if( h->param.rc.i_incremental_lookahead )
+    {
+        memset( frame->i_propagate_cost, 0, h->mb.i_mb_count * sizeof(uint16_t) );
+        frame->i_mbtree_ref[0] = frame->i_mbtree_ref[1] = -1;
+    }
 
     for( int y = 0; y < h->param.i_bframe + 2; y++ )
         for( int x = 0; x < h->param.i_bframe + 2; x++ )
@@ -476,6 +527,21 @@ void x264_frame_init_lowres( x264_t *h, x264_frame_t *frame )
     for( int y = 0; y <= !!h->param.i_bframe; y++ )
         for( int x = 0; x <= h->param.i_bframe; x++ )
             frame->lowres_mvs[y][x][0][0] = 0x7FFF;
+
+    if( h->frames.b_have_coarse )
+    {
+        h->mc.frame_init_lowres_core( frame->lowres[0], frame->coarse[0], frame->coarse[1], frame->coarse[2], frame->coarse[3],
+                                      frame->i_stride_lowres, frame->i_stride_coarse, frame->i_width_coarse, frame->i_lines_coarse );
+        x264_frame_expand_border_coarse( frame );
+
+        memset( frame->i_coarse_cost, -1, sizeof(frame->i_coarse_cost) );
+        for( int y = 0; y <= !!h->param.i_bframe; y++ )
+            for( int x = 0; x <= h->param.i_bframe; x++ )
+                frame->coarse_mvs[y][x][0][0] = 0x7FFF;
+    }
+
+    if( h->param.b_scenecut_prefilter )
+        frame_init_scenecut_stats( h, frame );
 }
 
 static void frame_init_lowres_core( pixel *src0, pixel *dst0, pixel *dsth, pixel *dstv, pixel *dstc,
@@ -515,6 +515,31 @@ int x264_mb_predict_mv_direct16x16( x264_t *h, int *b_changed )
     return b_available;
 }
 
+int x264_mb_predict_mv_lowres( x264_t *h, int i_list, int i_ref, int16_t mv[2] )
+{
+    if( !h->frames.b_have_lowres || (i_ref && SLICE_MBAFF) )
+        return 0;
+
+    x264_frame_t *ref = h->fref[i_list][i_ref];
+    int dist = i_list ? ref->i_frame - h->fenc->i_frame : h->fenc->i_frame - ref->i_frame;
+    for( int d = X264_MIN( dist, h->param.i_bframe+1 ); d > 0; d-- )
+    {
+        int16_t (*lowres_mv)[2] = h->fenc->lowres_mvs[i_list][d-1];
+        if( lowres_mv[0][0] == 0x7fff )
+            continue;
+        if( d == dist )
+            M32( mv ) = (M32( lowres_mv[h->mb.i_mb_xy] )*2)&0xfffeffff;
+        else
+        {
+            /* Scaling up can overflow the mv, so clip it to the search range. */
+            mv[0] = x264_clip3( lowres_mv[h->mb.i_mb_xy][0] * 2 * dist / d, h->mb.mv_min_spel[0], h->mb.mv_max_spel[0] );
+            mv[1] = x264_clip3( lowres_mv[h->mb.i_mb_xy][1] * 2 * dist / d, h->mb.mv_min_spel[1], h->mb.mv_max_spel[1] );
+        }
+        return 1;
+    }
+    return 0;
+}
+
 /* This just improves encoder performance, it's not part of the spec */
 void x264_mb_predict_mv_ref16x16( x264_t *h, int i_list, int i_ref, int16_t mvc[9][2], int *i_mvc )
 {
@@ -544,20 +569,8 @@ void x264_mb_predict_mv_ref16x16( x264_t *h, int i_list, int i_ref, int16_t mvc[
         SET_MVP( h->mb.cache.mv[i_list][x264_scan8[12]] );
     }
 
-    if( i_ref == 0 && h->frames.b_have_lowres )
-    {
-        int idx = i_list ? h->fref[1][0]->i_frame-h->fenc->i_frame-1
-                         : h->fenc->i_frame-h->fref[0][0]->i_frame-1;
-        if( idx <= h->param.i_bframe )
-        {
-            int16_t (*lowres_mv)[2] = h->fenc->lowres_mvs[i_list][idx];
-            if( lowres_mv[0][0] != 0x7fff )
-            {
-                M32( mvc[i] ) = (M32( lowres_mv[h->mb.i_mb_xy] )*2)&0xfffeffff;
-                i++;
-            }
-        }
-    }
+    if( x264_mb_predict_mv_lowres( h, i_list, i_ref, mvc[i] ) )
+        i++;
 
     /* spatial predictors */
     if( SLICE_MBAFF )
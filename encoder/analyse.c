@@ -53,6 +53,24 @@ typedef struct
     ALIGNED_4( int16_t mvc[32][5][2] );
 } x264_mb_analysis_list_t;
 
+/* Features of an inter mb known once its 16x16 search is done, fed to the partition model.
+ * The order is that of the columns of --partition-log. */
+enum model_feature_e
+{
+    MODEL_QP,
+    MODEL_COST,         /* best 16x16 inter cost */
+    MODEL_COST_MV,
+    MODEL_REF,
+    MODEL_LOWRES_INTRA, /* lookahead intra cost, -1 if unknown */
+    MODEL_COST_RATIO,   /* 16 * cost / lowres intra cost */
+    MODEL_AQ,           /* aq offset in quarter qps */
+    MODEL_NB_SPLIT,     /* neighbours using partitions smaller than 16x16 */
+    MODEL_NB_INTRA,
+    MODEL_NB_SKIP,
+    MODEL_COL_SPLIT,    /* the colocated mb of the first reference was split */
+    MODEL_FEATURES
+};
+
 typedef struct
 {
     /* conduct the analysis using this lamda and QP */
@@ -118,6 +136,18 @@ typedef struct
     int b_direct_available;
     int b_early_terminate;
 
+    /* partition model decisions; all set unless --partition-model rules the mode out */
+    int b_try_split;
+    int b_try_sub8x8;
+    int b_try_intra;
+    int b_model_log;
+    int model_feature[MODEL_FEATURES];
+
+    /* intra modes the edge-direction pre-pass leaves to search, set by --intra-gradient */
+    int b_intra_gradient;
+    uint16_t i_gradient_modes4x4[16];
+    uint16_t i_gradient_modes8x8[4];
+
 } x264_mb_analysis_t;
 
 /* TODO: calculate CABAC costs */
@@ -133,6 +163,100 @@ static const uint8_t i_sub_mb_b_cost_table[13] =
 {
     7, 5, 5, 3, 7, 5, 7, 3, 7, 7, 7, 5, 1
 };
+
+typedef struct
+{
+    int8_t   feature;   /* -1 for a leaf */
+    int32_t  threshold; /* go left if the feature is <= threshold; for a leaf, whether to try the mode */
+    uint16_t left, right;
+} x264_model_node_t;
+
+#include "analyse_model.h"
+
+static const char * const model_feature_names[MODEL_FEATURES] =
+{
+    "qp", "cost", "cost_mv", "ref", "lowres_intra", "cost_ratio", "aq", "nb_split", "nb_intra", "nb_skip", "col_split"
+};
+
+static int model_try( const x264_model_node_t *tree, const int *feature )
+{
+    int i = 0;
+    while( tree[i].feature >= 0 )
+        i = feature[tree[i].feature] <= tree[i].threshold ? tree[i].left : tree[i].right;
+    return tree[i].threshold;
+}
+
+static int model_neighbour_split( x264_t *h, int type, int xy )
+{
+    return type >= 0 && !IS_INTRA( type ) && !IS_SKIP( type ) && h->mb.partition[xy] != D_16x16;
+}
+
+/* Decide from the 16x16 search which of the smaller partitions and intra are worth trying. */
+static void mb_analyse_model( x264_t *h, x264_mb_analysis_t *a, int cost, int cost_mv, int ref )
+{
+    int *f = a->model_feature;
+    int mb_xy = h->mb.i_mb_xy;
+    int types[4] = { h->mb.i_mb_type_left[0], h->mb.i_mb_type_top, h->mb.i_mb_type_topleft, h->mb.i_mb_type_topright };
+    int xys[4] = { h->mb.i_mb_left_xy[0], h->mb.i_mb_top_xy, h->mb.i_mb_topleft_xy, h->mb.i_mb_topright_xy };
+    x264_frame_t *col = h->fref[h->sh.i_type == SLICE_TYPE_B][0];
+
+    f[MODEL_QP] = h->mb.i_qp;
+    f[MODEL_COST] = cost;
+    f[MODEL_COST_MV] = cost_mv;
+    f[MODEL_REF] = ref;
+    f[MODEL_LOWRES_INTRA] = h->frames.b_have_lowres && h->fenc->i_cost_est[0][0] >= 0 ? h->fenc->i_intra_cost[mb_xy] : -1;
+    f[MODEL_COST_RATIO] = f[MODEL_LOWRES_INTRA] >= 0 ? (int)X264_MIN( 16LL * cost / (f[MODEL_LOWRES_INTRA] + 1), COST_MAX ) : -1;
+    f[MODEL_AQ] = h->fenc->f_qp_offset ? (int)floorf( h->fenc->f_qp_offset[mb_xy] * 4.f + .5f ) : 0;
+    f[MODEL_NB_SPLIT] = f[MODEL_NB_INTRA] = f[MODEL_NB_SKIP] = 0;
+    for( int i = 0; i < 4; i++ )
+    {
+        f[MODEL_NB_SPLIT] += model_neighbour_split( h, types[i], xys[i] );
+        f[MODEL_NB_INTRA] += types[i] >= 0 && IS_INTRA( types[i] );
+        f[MODEL_NB_SKIP]  += types[i] >= 0 && IS_SKIP( types[i] );
+    }
+    f[MODEL_COL_SPLIT] = !IS_INTRA( col->mb_type[mb_xy] ) && col->mb_partition[mb_xy] != D_16x16;
+
+    a->b_model_log = !!h->partition_log;
+    if( h->param.analyse.b_partition_model )
+    {
+        if( h->sh.i_type == SLICE_TYPE_P )
+        {
+            a->b_try_split  &= model_try( partition_model_p_split, f );
+            a->b_try_intra  &= a->b_force_intra || model_try( partition_model_p_intra, f );
+        }
+        else
+        {
+            a->b_try_split  &= model_try( partition_model_b_split, f );
+            a->b_try_intra  &= model_try( partition_model_b_intra, f );
+        }
+    }
+}
+
+void x264_analyse_model_log_header( x264_t *h )
+{
+    fprintf( h->partition_log->fh, "slice" );
+    for( int i = 0; i < MODEL_FEATURES; i++ )
+        fprintf( h->partition_log->fh, ",%s", model_feature_names[i] );
+    fprintf( h->partition_log->fh, ",split,sub8x8,intra\n" );
+}
+
+/* One line per mb: the features and which of the modes the full search picked. */
+static void mb_analyse_model_log( x264_t *h, x264_mb_analysis_t *a )
+{
+    char line[256], *s = line;
+    int type = h->mb.i_type;
+    int sub8x8 = 0;
+    if( type == P_8x8 )
+        for( int i = 0; i < 4; i++ )
+            sub8x8 |= h->mb.i_sub_partition[i] != D_L0_8x8;
+    s += sprintf( s, "%c", h->sh.i_type == SLICE_TYPE_P ? 'P' : 'B' );
+    for( int i = 0; i < MODEL_FEATURES; i++ )
+        s += sprintf( s, ",%d", a->model_feature[i] );
+    sprintf( s, ",%d,%d,%d\n", !IS_INTRA( type ) && h->mb.i_partition != D_16x16, sub8x8, IS_INTRA( type ) );
+    x264_pthread_mutex_lock( &h->partition_log->mutex );
+    fputs( line, h->partition_log->fh );
+    x264_pthread_mutex_unlock( &h->partition_log->mutex );
+}
 static const uint8_t i_sub_mb_p_cost_table[4] =
 {
     5, 3, 3, 1
@@ -158,7 +282,7 @@ static int init_costs( x264_t *h, float *logs, int qp )
     for( int i = 0; i < 3; i++ )
         for( int j = 0; j < 33; j++ )
             h->cost_table->ref[qp][i][j] = i ? X264_MIN( lambda * bs_size_te( i, j ), UINT16_MAX ) : 0;
-    if( h->param.analyse.i_me_method >= X264_ME_ESA && !h->cost_mv_fpel[qp][0] )
+    if( ME_EXHAUSTIVE( h->param.analyse.i_me_method ) && !h->cost_mv_fpel[qp][0] )
     {
         for( int j = 0; j < 4; j++ )
         {
@@ -300,6 +424,9 @@ static void mb_analyse_init( x264_t *h, x264_mb_analysis_t *a, int qp )
     /* mbrd == 3 -> QPRD */
     a->i_mbrd = (subme>=6) + (subme>=8) + (h->param.analyse.i_subpel_refine>=10);
     h->mb.b_deblock_rdo = h->param.analyse.i_subpel_refine >= 9 && h->sh.i_disable_deblocking_filter_idc != 1;
+    /* Near-duplicate frames: no RD, see also x264_macroblock_thread_init */
+    if( h->fenc->i_duplicate == 2 )
+        a->i_mbrd = h->mb.b_deblock_rdo = 0;
     a->b_early_terminate = h->param.analyse.i_subpel_refine < 11;
 
     mb_analyse_init_qp( h, a, qp );
@@ -319,6 +446,11 @@ static void mb_analyse_init( x264_t *h, x264_mb_analysis_t *a, int qp )
 
     a->b_fast_intra = 0;
     a->b_avoid_topright = 0;
+    a->b_try_split =
+    a->b_try_sub8x8 =
+    a->b_try_intra = h->fenc->i_duplicate != 2;
+    a->b_model_log = 0;
+    a->b_intra_gradient = 0;
     h->mb.i_skip_intra =
         h->mb.b_lossless ? 0 :
         a->i_mbrd ? 2 :
@@ -355,7 +487,7 @@ static void mb_analyse_init( x264_t *h, x264_mb_analysis_t *a, int qp )
             if( h->i_thread_frames > 1 )
             {
                 int pix_y = (h->mb.i_mb_y | PARAM_INTERLACED) * 16;
-                int thresh = pix_y + h->param.analyse.i_mv_range_thread;
+                int thresh = pix_y + h->fenc->i_mv_range_thread;
                 for( int i = (h->sh.i_type == SLICE_TYPE_B); i >= 0; i-- )
                     for( int j = 0; j < h->i_ref[i]; j++ )
                     {
@@ -364,11 +496,13 @@ static void mb_analyse_init( x264_t *h, x264_mb_analysis_t *a, int qp )
                     }
 
                 if( h->param.b_deterministic )
-                    thread_mvy_range = h->param.analyse.i_mv_range_thread;
+                    thread_mvy_range = h->fenc->i_mv_range_thread;
                 if( PARAM_INTERLACED )
                     thread_mvy_range >>= 1;
 
-                x264_analyse_weight_frame( h, pix_y + thread_mvy_range );
+                /* Sliced frame threads weight the whole frame before splitting it. */
+                if( !h->param.b_sliced_threads )
+                    x264_analyse_weight_frame( h, pix_y + thread_mvy_range );
             }
 
             if( PARAM_INTERLACED )
@@ -467,6 +601,7 @@ static void mb_analyse_init( x264_t *h, x264_mb_analysis_t *a, int qp )
         }
         else
             a->b_force_intra = 0;
+        a->b_try_intra |= a->b_force_intra;
     }
 }
 
@@ -664,6 +799,92 @@ static void mb_analyse_intra_chroma( x264_t *h, x264_mb_analysis_t *a )
     h->mb.i_chroma_pred_mode = a->i_predict8x8chroma;
 }
 
+/* Edge-direction pre-pass for --intra-gradient: a Sobel filter over the source mb
+ * votes each pixel's edge orientation, weighted by gradient strength, into one of
+ * the 8 directional intra modes.  Every block keeps DC and its i_intra_gradient
+ * strongest directions; mb_analyse_intra and intra_rd_refine skip the rest. */
+static void mb_analyse_intra_gradient( x264_t *h, x264_mb_analysis_t *a )
+{
+    /* orientation of the edge in 22.5 degree steps, from horizontal through vertical */
+    static const uint8_t sector_mode[8] =
+    {
+        I_PRED_4x4_H,  I_PRED_4x4_HD, I_PRED_4x4_DDR, I_PRED_4x4_VR,
+        I_PRED_4x4_V,  I_PRED_4x4_VL, I_PRED_4x4_DDL, I_PRED_4x4_HU
+    };
+    pixel *src = h->mb.pic.p_fenc[0];
+    int16_t diff[18][16], sum[18][16];
+    int hist[16][8] = {{0}};
+    int keep = h->param.analyse.i_intra_gradient;
+
+    /* separable Sobel: horizontal difference and [1 2 1] sum of each row, with the
+     * mb edges replicated rather than looking outside it */
+    for( int y = 0; y < 18; y++ )
+    {
+        pixel *p = src + x264_clip3( y-1, 0, 15 ) * FENC_STRIDE;
+        diff[y][0]  = p[1] - p[0];
+        sum[y][0]   = 3*p[0] + p[1];
+        for( int x = 1; x < 15; x++ )
+        {
+            diff[y][x] = p[x+1] - p[x-1];
+            sum[y][x]  = p[x-1] + 2*p[x] + p[x+1];
+        }
+        diff[y][15] = p[15] - p[14];
+        sum[y][15]  = p[14] + 3*p[15];
+    }
+
+    for( int y = 0; y < 16; y++ )
+        for( int x = 0; x < 16; x++ )
+        {
+            int gx = diff[y][x] + 2*diff[y+1][x] + diff[y+2][x];
+            int gy = sum[y+2][x] - sum[y][x];
+            int ax = abs( gx ) << 8;
+            int ay = abs( gy );
+            /* the edge runs perpendicular to the gradient, so its slope is ax/ay;
+             * bin it against tan(11.25), tan(33.75), tan(56.25) and tan(78.75) in Q8. */
+            int s = (ax >= ay*51) + (ax >= ay*171) + (ax >= ay*383) + (ax >= ay*1287);
+            if( (s & 3) && (gx ^ gy) >= 0 )
+                s = 8 - s;
+            hist[(y>>2)*4 + (x>>2)][s&7] += (ax >> 8) + ay;
+        }
+
+    for( int idx = 0; idx < 20; idx++ )
+    {
+        int h8[8];
+        int *bins;
+        if( idx < 16 )
+            bins = hist[block_idx_y[idx]*4 + block_idx_x[idx]];
+        else
+        {
+            int x = 2*((idx-16)&1), y = 2*((idx-16)>>1);
+            for( int i = 0; i < 8; i++ )
+                h8[i] = hist[y*4+x][i] + hist[y*4+x+1][i] + hist[y*4+x+4][i] + hist[y*4+x+5][i];
+            bins = h8;
+        }
+        int modes = 1 << I_PRED_4x4_DC;
+        int used = 0;
+        for( int k = 0; k < keep; k++ )
+        {
+            int best = -1;
+            for( int i = 0; i < 8; i++ )
+                if( !(used & (1 << i)) && (best < 0 || bins[i] > bins[best]) )
+                    best = i;
+            used |= 1 << best;
+            modes |= 1 << sector_mode[best];
+        }
+        if( idx < 16 )
+            a->i_gradient_modes4x4[idx] = modes;
+        else
+            a->i_gradient_modes8x8[idx-16] = modes;
+    }
+    a->b_intra_gradient = 1;
+}
+
+/* The predicted mode is cheap to signal, so it is always searched too. */
+static ALWAYS_INLINE int intra_gradient_skip( x264_mb_analysis_t *a, int modes, int i_pred_mode, int i_mode )
+{
+    return a->b_intra_gradient && !((modes | (1 << i_pred_mode)) & (1 << x264_mb_pred_mode4x4_fix( i_mode )));
+}
+
 /* FIXME: should we do any sort of merged chroma analysis with 4:4:4? */
 static void mb_analyse_intra( x264_t *h, x264_mb_analysis_t *a, int i_satd_inter )
 {
@@ -741,6 +962,9 @@ static void mb_analyse_intra( x264_t *h, x264_mb_analysis_t *a, int i_satd_inter
             return;
     }
 
+    if( h->param.analyse.i_intra_gradient && !a->b_intra_gradient && (flags & (X264_ANALYSE_I8x8|X264_ANALYSE_I4x4)) )
+        mb_analyse_intra_gradient( h, a );
+
     uint16_t *cost_i4x4_mode = h->cost_table->i4x4_mode[a->i_qp] + 8;
     /* 8x8 prediction selection */
     if( flags & X264_ANALYSE_I8x8 )
@@ -768,7 +992,7 @@ static void mb_analyse_intra( x264_t *h, x264_mb_analysis_t *a, int i_satd_inter
             const int8_t *predict_mode = predict_8x8_mode_available( a->b_avoid_topright, h->mb.i_neighbour8[idx], idx );
             h->predict_8x8_filter( p_dst_by, edge, h->mb.i_neighbour8[idx], ALL_NEIGHBORS );
 
-            if( h->pixf.intra_mbcmp_x9_8x8 && predict_mode[8] >= 0 )
+            if( h->pixf.intra_mbcmp_x9_8x8 && predict_mode[8] >= 0 && !a->b_intra_gradient )
             {
                 /* No shortcuts here. The SSSE3 implementation of intra_mbcmp_x9 is fast enough. */
                 i_best = h->pixf.intra_mbcmp_x9_8x8( p_src_by, p_dst_by, edge, cost_i4x4_mode-i_pred_mode, a->i_satd_i8x8_dir[idx] );
@@ -806,6 +1030,8 @@ static void mb_analyse_intra( x264_t *h, x264_mb_analysis_t *a, int i_satd_inter
                 {
                     int i_satd;
                     int i_mode = *predict_mode;
+                    if( intra_gradient_skip( a, a->i_gradient_modes8x8[idx], i_pred_mode, i_mode ) )
+                        continue;
 
                     if( h->mb.b_lossless )
                         x264_predict_lossless_8x8( h, p_dst_by, 0, idx, i_mode, edge );
@@ -886,7 +1112,7 @@ static void mb_analyse_intra( x264_t *h, x264_mb_analysis_t *a, int i_satd_inter
                 /* emulate missing topright samples */
                 MPIXEL_X4( &p_dst_by[4 - FDEC_STRIDE] ) = PIXEL_SPLAT_X4( p_dst_by[3 - FDEC_STRIDE] );
 
-            if( h->pixf.intra_mbcmp_x9_4x4 && predict_mode[8] >= 0 )
+            if( h->pixf.intra_mbcmp_x9_4x4 && predict_mode[8] >= 0 && !a->b_intra_gradient )
             {
                 /* No shortcuts here. The SSSE3 implementation of intra_mbcmp_x9 is fast enough. */
                 i_best = h->pixf.intra_mbcmp_x9_4x4( p_src_by, p_dst_by, cost_i4x4_mode-i_pred_mode );
@@ -923,6 +1149,8 @@ static void mb_analyse_intra( x264_t *h, x264_mb_analysis_t *a, int i_satd_inter
                     {
                         int i_satd;
                         int i_mode = *predict_mode;
+                        if( intra_gradient_skip( a, a->i_gradient_modes4x4[idx], i_pred_mode, i_mode ) )
+                            continue;
 
                         if( h->mb.b_lossless )
                             x264_predict_lossless_4x4( h, p_dst_by, 0, idx, i_mode );
@@ -1099,9 +1327,13 @@ static void intra_rd_refine( x264_t *h, x264_mb_analysis_t *a )
                     /* emulate missing topright samples */
                     MPIXEL_X4( dst[p]+4-FDEC_STRIDE ) = PIXEL_SPLAT_X4( dst[p][3-FDEC_STRIDE] );
 
+            int i_satd_mode = a->i_predict4x4[idx];
+            int i_pred_mode = x264_mb_predict_intra4x4_mode( h, idx );
             for( ; *predict_mode >= 0; predict_mode++ )
             {
                 int i_mode = *predict_mode;
+                if( i_mode != i_satd_mode && intra_gradient_skip( a, a->i_gradient_modes4x4[idx], i_pred_mode, i_mode ) )
+                    continue;
                 i_satd = rd_cost_i4x4( h, a->i_lambda2, idx, i_mode );
 
                 if( i_best > i_satd )
@@ -1147,6 +1379,8 @@ static void intra_rd_refine( x264_t *h, x264_mb_analysis_t *a )
                              h->mb.pic.p_fdec[2] + 8*x + 8*y*FDEC_STRIDE};
             int cbp_luma_new = 0;
             int i_thresh = a->b_early_terminate ? a->i_satd_i8x8_dir[idx][a->i_predict8x8[idx]] * 11/8 : COST_MAX;
+            int i_satd_mode = a->i_predict8x8[idx];
+            int i_pred_mode = x264_mb_predict_intra4x4_mode( h, 4*idx );
 
             i_best = COST_MAX64;
 
@@ -1159,6 +1393,8 @@ static void intra_rd_refine( x264_t *h, x264_mb_analysis_t *a )
                 int i_mode = *predict_mode;
                 if( a->i_satd_i8x8_dir[idx][i_mode] > i_thresh )
                     continue;
+                if( i_mode != i_satd_mode && intra_gradient_skip( a, a->i_gradient_modes8x8[idx], i_pred_mode, i_mode ) )
+                    continue;
 
                 h->mb.i_cbp_luma = a->i_cbp_i8x8_luma;
                 i_satd = rd_cost_i8x8( h, a->i_lambda2, idx, i_mode, edge );
@@ -1240,11 +1476,23 @@ static void intra_rd_refine( x264_t *h, x264_mb_analysis_t *a )
 #define REF_COST(list, ref) \
     (a->p_cost_ref[list][ref])
 
+/* When the lookahead's mv agrees with the spatial predictor, the motion is rarely
+ * far from either: UMH and the exhaustive searches can use half the range. */
+static int mb_analyse_me_range( x264_t *h, int i_list, int i_ref, int16_t mvp[2] )
+{
+    int16_t mv[2];
+    if( h->mb.i_me_method >= X264_ME_UMH
+        && x264_mb_predict_mv_lowres( h, i_list, i_ref, mv )
+        && abs( mv[0] - mvp[0] ) + abs( mv[1] - mvp[1] ) <= 8 )
+        return X264_MAX( h->param.analyse.i_me_range >> 1, 4 );
+    return h->param.analyse.i_me_range;
+}
+
 static void mb_analyse_inter_p16x16( x264_t *h, x264_mb_analysis_t *a )
 {
     x264_me_t m;
     int i_mvc;
-    ALIGNED_4( int16_t mvc[8][2] );
+    ALIGNED_4( int16_t mvc[8+HASH_ME_CANDIDATES][2] );
     int i_halfpel_thresh = INT_MAX;
     int *p_halfpel_thresh = (a->b_early_terminate && h->mb.pic.i_fref[0]>1) ? &i_halfpel_thresh : NULL;
 
@@ -1272,7 +1520,9 @@ static void mb_analyse_inter_p16x16( x264_t *h, x264_mb_analysis_t *a )
         else
         {
             x264_mb_predict_mv_ref16x16( h, 0, i_ref, mvc, &i_mvc );
-            x264_me_search_ref( h, &m, mvc, i_mvc, p_halfpel_thresh );
+            if( h->param.analyse.b_hash_me )
+                i_mvc = x264_me_hash_predictors( h, h->fref[0][i_ref], m.p_fenc[0], 16*h->mb.i_mb_x, 16*h->mb.i_mb_y, mvc, i_mvc );
+            x264_me_search_ref( h, &m, mvc, i_mvc, p_halfpel_thresh, mb_analyse_me_range( h, 0, i_ref, m.mvp ) );
         }
 
         /* save mv for predicting neighbors */
@@ -1882,7 +2132,7 @@ static void mb_analyse_inter_b16x16( x264_t *h, x264_mb_analysis_t *a )
     pixel *src0, *src1;
     intptr_t stride0 = 16, stride1 = 16;
     int i_ref, i_mvc;
-    ALIGNED_4( int16_t mvc[9][2] );
+    ALIGNED_4( int16_t mvc[9+HASH_ME_CANDIDATES][2] );
     int try_skip = a->b_try_skip;
     int list1_skipped = 0;
     int i_halfpel_thresh[2] = {INT_MAX, INT_MAX};
@@ -1923,7 +2173,9 @@ static void mb_analyse_inter_b16x16( x264_t *h, x264_mb_analysis_t *a )
             LOAD_HPELS( &m, h->mb.pic.p_fref[l][i_ref], l, i_ref, 0, 0 );
             x264_mb_predict_mv_16x16( h, l, i_ref, m.mvp );
             x264_mb_predict_mv_ref16x16( h, l, i_ref, mvc, &i_mvc );
-            x264_me_search_ref( h, &m, mvc, i_mvc, p_halfpel_thresh[l] );
+            if( h->param.analyse.b_hash_me )
+                i_mvc = x264_me_hash_predictors( h, h->fref[l][i_ref], m.p_fenc[0], 16*h->mb.i_mb_x, 16*h->mb.i_mb_y, mvc, i_mvc );
+            x264_me_search_ref( h, &m, mvc, i_mvc, p_halfpel_thresh[l], mb_analyse_me_range( h, l, i_ref, m.mvp ) );
 
             /* add ref cost */
             m.cost += m.i_ref_cost;
@@ -2900,6 +3152,63 @@ static inline void mb_analyse_qp_rd( x264_t *h, x264_mb_analysis_t *a )
     }
 }
 
+/* The lookahead compares lowres luma against the sources of the references, so a change in chroma,
+ * or a slow change that slips under its threshold frame after frame, goes unnoticed there.  Check the
+ * reconstructions too: they must still be within about the quantization error of this frame. */
+static int mb_analyse_static( x264_t *h )
+{
+    int thresh = 128 * (1 << (BIT_DEPTH-8)) + 64 * x264_lambda_tab[h->mb.i_qp];
+    int chroma_thresh = thresh >> (CHROMA_H_SHIFT + CHROMA_V_SHIFT);
+    int chroma_size = CHROMA444 ? PIXEL_16x16 : CHROMA_FORMAT == CHROMA_422 ? PIXEL_8x16 : PIXEL_8x8;
+    for( int l = 0; l <= (h->sh.i_type == SLICE_TYPE_B); l++ )
+    {
+        if( h->fref[l][0]->effective_qp[h->mb.i_mb_xy] > h->mb.i_qp ||
+            h->pixf.sad[PIXEL_16x16]( h->mb.pic.p_fenc[0], FENC_STRIDE, h->mb.pic.p_fref[l][0][0], h->mb.pic.i_stride[0] ) > thresh )
+            return 0;
+        if( CHROMA_FORMAT )
+        {
+            /* Not into fdec: B-frame analysis still needs the direct prediction there. */
+            ALIGNED_ARRAY_64( pixel, pixuv, [16*FDEC_STRIDE] );
+            pixel *ref[2] = { h->mb.pic.p_fref[l][0][4], h->mb.pic.p_fref[l][0][8] };
+            intptr_t stride = h->mb.pic.i_stride[1];
+            if( !CHROMA444 )
+            {
+                h->mc.load_deinterleave_chroma_fdec( pixuv, h->mb.pic.p_fref[l][0][4], h->mb.pic.i_stride[1],
+                                                     CHROMA_FORMAT == CHROMA_422 ? 16 : 8 );
+                ref[0] = pixuv;
+                ref[1] = pixuv + FDEC_STRIDE/2;
+                stride = FDEC_STRIDE;
+            }
+            for( int ch = 0; ch < 2; ch++ )
+                if( h->pixf.sad[chroma_size]( h->mb.pic.p_fenc[1+ch], FENC_STRIDE, ref[ch], stride ) > chroma_thresh )
+                    return 0;
+        }
+    }
+    return 1;
+}
+
+/* Whether B_SKIP predicts from the nearest references at zero motion. */
+/* Duplicate frames copy their references, so skips are only as good as the references were coded. */
+static int mb_analyse_dup( x264_t *h )
+{
+    for( int l = 0; l <= (h->sh.i_type == SLICE_TYPE_B); l++ )
+        if( h->fref[l][0]->effective_qp[h->mb.i_mb_xy] > h->mb.i_qp )
+            return 0;
+    return 1;
+}
+
+static int mb_direct_is_static( x264_t *h )
+{
+    for( int l = 0; l < 2; l++ )
+        for( int i = 0; i < 16; i++ )
+        {
+            int ref = h->mb.cache.ref[l][x264_scan8[i]];
+            if( ref > 0 || (ref == 0 && M32( h->mb.cache.mv[l][x264_scan8[i]] )) )
+                return 0;
+        }
+    return 1;
+}
+
 /*****************************************************************************
  * x264_macroblock_analyse:
  *****************************************************************************/
@@ -2908,16 +3217,24 @@ void x264_macroblock_analyse( x264_t *h )
     x264_mb_analysis_t analysis;
     int i_cost = COST_MAX;
 
+    x264_me_cache_reset( h );
+    rd_cache_reset( h );
     h->mb.i_qp = x264_ratecontrol_mb_qp( h );
     /* If the QP of this MB is within 1 of the previous MB, code the same QP as the previous MB,
      * to lower the bit cost of the qp_delta.  Don't do this if QPRD is enabled. */
     if( h->param.rc.i_aq_mode && h->param.analyse.i_subpel_refine < 10 )
         h->mb.i_qp = abs(h->mb.i_qp - h->mb.i_last_qp) == 1 ? h->mb.i_last_qp : h->mb.i_qp;
 
-    if( h->param.analyse.b_mb_info )
+    if( h->param.analyse.b_mb_info || h->param.analyse.b_static_skip || h->param.analyse.i_dup_skip )
         h->fdec->effective_qp[h->mb.i_mb_xy] = h->mb.i_qp; /* Store the real analysis QP. */
     mb_analyse_init( h, &analysis, h->mb.i_qp );
 
+    /* The lookahead's static map keeps only the mbs that end up force-skipped, for deblocking. */
+    int b_static = h->param.analyse.b_static_skip && h->fenc->i_static_ref[0] >= 0 && h->fenc->static_mb[h->mb.i_mb_xy];
+    int b_dup = h->fenc->i_duplicate == 1;
+    if( h->fenc->i_static_ref[0] >= 0 )
+        h->fenc->static_mb[h->mb.i_mb_xy] = 0;
+
     /*--------------------------- Do the analysis ---------------------------*/
     if( h->sh.i_type == SLICE_TYPE_I )
     {
@@ -2955,12 +3272,16 @@ intra_analysis:
         }
         else
         {
-            /* Special fast-skip logic using information from mb_info. */
-            if( h->fdec->mb_info && (h->fdec->mb_info[h->mb.i_mb_xy]&X264_MBINFO_CONSTANT) )
+            /* Special fast-skip logic using information from mb_info or the lookahead's static map. */
+            int b_constant = h->fdec->mb_info && (h->fdec->mb_info[h->mb.i_mb_xy]&X264_MBINFO_CONSTANT);
+            if( b_constant || b_static || b_dup )
             {
-                if( !SLICE_MBAFF && (h->fdec->i_frame - h->fref[0][0]->i_frame) == 1 && !h->sh.b_weighted_pred &&
-                    h->fref[0][0]->effective_qp[h->mb.i_mb_xy] <= h->mb.i_qp )
+                if( !SLICE_MBAFF && !h->sh.b_weighted_pred && ((b_dup && mb_analyse_dup( h )) ||
+                    (b_constant && (h->fdec->i_frame - h->fref[0][0]->i_frame) == 1 &&
+                     h->fref[0][0]->effective_qp[h->mb.i_mb_xy] <= h->mb.i_qp) || (b_static && mb_analyse_static( h ))) )
                 {
+                    if( b_static || b_dup )
+                        h->fenc->static_mb[h->mb.i_mb_xy] = 1;
                     h->mb.i_partition = D_16x16;
                     /* Use the P-SKIP MV if we can... */
                     if( !M32(h->mb.cache.pskip_mv) )
@@ -2978,7 +3299,7 @@ intra_analysis:
                     goto skip_analysis;
                 }
                 /* Reset the information accordingly */
-                else if( h->param.analyse.b_mb_info_update )
+                if( b_constant && h->param.analyse.b_mb_info_update )
                     h->fdec->mb_info[h->mb.i_mb_xy] &= ~X264_MBINFO_CONSTANT;
             }
 
@@ -3032,7 +3353,10 @@ skip_analysis:
                 return;
             }
 
-            if( flags & X264_ANALYSE_PSUB16x16 )
+            if( h->param.analyse.b_partition_model || h->partition_log )
+                mb_analyse_model( h, &analysis, analysis.l0.me16x16.cost, analysis.l0.me16x16.cost_mv, analysis.l0.me16x16.i_ref );
+
+            if( (flags & X264_ANALYSE_PSUB16x16) && analysis.b_try_split )
             {
                 if( h->param.analyse.b_mixed_references )
                     mb_analyse_inter_p8x8_mixed_ref( h, &analysis );
@@ -3045,7 +3369,7 @@ skip_analysis:
             i_partition = D_16x16;
             i_cost = analysis.l0.me16x16.cost;
 
-            if( ( flags & X264_ANALYSE_PSUB16x16 ) && (!analysis.b_early_terminate ||
+            if( ( flags & X264_ANALYSE_PSUB16x16 ) && analysis.b_try_split && (!analysis.b_early_terminate ||
                 analysis.l0.i_cost8x8 < analysis.l0.me16x16.cost) )
             {
                 i_type = P_8x8;
@@ -3053,7 +3377,7 @@ skip_analysis:
                 i_cost = analysis.l0.i_cost8x8;
 
                 /* Do sub 8x8 */
-                if( flags & X264_ANALYSE_PSUB8x8 )
+                if( (flags & X264_ANALYSE_PSUB8x8) && analysis.b_try_sub8x8 )
                 {
                     for( int i = 0; i < 4; i++ )
                     {
@@ -3082,7 +3406,7 @@ skip_analysis:
 
             /* Now do 16x8/8x16 */
             int i_thresh16x8 = analysis.l0.me8x8[1].cost_mv + analysis.l0.me8x8[2].cost_mv;
-            if( ( flags & X264_ANALYSE_PSUB16x16 ) && (!analysis.b_early_terminate ||
+            if( ( flags & X264_ANALYSE_PSUB16x16 ) && analysis.b_try_split && (!analysis.b_early_terminate ||
                 analysis.l0.i_cost8x8 < analysis.l0.me16x16.cost + i_thresh16x8) )
             {
                 int i_avg_mv_ref_cost = (analysis.l0.me8x8[2].cost_mv + analysis.l0.me8x8[2].i_ref_cost
@@ -3166,7 +3490,11 @@ skip_analysis:
                 }
             }
 
-            if( h->mb.b_chroma_me )
+            if( !analysis.b_try_intra )
+            {
+                /* leave the intra costs at COST_MAX */
+            }
+            else if( h->mb.b_chroma_me )
             {
                 if( CHROMA444 )
                 {
@@ -3346,6 +3674,10 @@ skip_analysis:
                 if( h->param.analyse.i_subpel_refine < 3 )
                     b_skip = analysis.b_try_skip;
             }
+            /* Skip static mbs and duplicate frames outright if direct doesn't move them. */
+            if( (b_static || b_dup) && !b_skip && !SLICE_MBAFF && mb_direct_is_static( h ) &&
+                ((b_dup && mb_analyse_dup( h )) || (b_static && mb_analyse_static( h ))) )
+                b_skip = h->fenc->static_mb[h->mb.i_mb_xy] = 1;
             /* Set up MVs for future predictors */
             if( b_skip )
             {
@@ -3404,7 +3736,11 @@ skip_analysis:
                 }
             }
 
-            if( flags & X264_ANALYSE_BSUB16x16 )
+            if( h->param.analyse.b_partition_model || h->partition_log )
+                mb_analyse_model( h, &analysis, i_cost, X264_MIN( analysis.l0.me16x16.cost_mv, analysis.l1.me16x16.cost_mv ),
+                                  analysis.l0.me16x16.i_ref + analysis.l1.me16x16.i_ref );
+
+            if( (flags & X264_ANALYSE_BSUB16x16) && analysis.b_try_split )
             {
                 if( h->param.analyse.b_mixed_references )
                     mb_analyse_inter_b8x8_mixed_ref( h, &analysis );
@@ -3577,7 +3913,11 @@ skip_analysis:
                 h->mb.i_partition = i_partition;
             }
 
-            if( h->mb.b_chroma_me )
+            if( !analysis.b_try_intra )
+            {
+                /* leave the intra costs at COST_MAX */
+            }
+            else if( h->mb.b_chroma_me )
             {
                 if( CHROMA444 )
                 {
@@ -3704,6 +4044,9 @@ skip_analysis:
                 h->mb.i_partition = D_16x16;
     }
 
+    if( analysis.b_model_log )
+        mb_analyse_model_log( h, &analysis );
+
     if( !analysis.i_mbrd )
         mb_analyse_transform( h );
 
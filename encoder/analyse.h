@@ -35,11 +35,15 @@ void x264_analyse_free_costs( x264_t *h );
 void x264_analyse_weight_frame( x264_t *h, int end );
 #define x264_macroblock_analyse x264_template(macroblock_analyse)
 void x264_macroblock_analyse( x264_t *h );
+#define x264_analyse_model_log_header x264_template(analyse_model_log_header)
+void x264_analyse_model_log_header( x264_t *h );
 #define x264_slicetype_decide x264_template(slicetype_decide)
 void x264_slicetype_decide( x264_t *h );
 
 #define x264_slicetype_analyse x264_template(slicetype_analyse)
 void x264_slicetype_analyse( x264_t *h, int intra_minigop );
+#define x264_slicetype_row_costs x264_template(slicetype_row_costs)
+int  x264_slicetype_row_costs( x264_t *h, int *row_cost );
 
 #define x264_lookahead_init x264_template(lookahead_init)
 int  x264_lookahead_init( x264_t *h, int i_slicetype_length );
@@ -0,0 +1,38 @@
+/* Decision trees for --partition-model, generated by tools/partition_model.py; do not edit.
+ * features: qp, cost, cost_mv, ref, lowres_intra, cost_ratio, aq, nb_split, nb_intra, nb_skip, col_split */
+
+static const x264_model_node_t partition_model_p_split[15] =
+{
+    {  7,      0,   1,  14 }, {  2,     36,   2,  13 }, {  1,   3418,   3,  12 }, {  2,     20,   4,   9 },
+    {  1,   2875,   5,   6 }, { -1,      0,   0,   0 }, {  0,     27,   7,   8 }, { -1,      1,   0,   0 },
+    { -1,      0,   0,   0 }, {  0,     30,  10,  11 }, { -1,      1,   0,   0 }, { -1,      0,   0,   0 },
+    { -1,      1,   0,   0 }, { -1,      1,   0,   0 }, { -1,      1,   0,   0 },
+};
+
+static const x264_model_node_t partition_model_p_intra[27] =
+{
+    {  8,      0,   1,  20 }, {  1,   9778,   2,  19 }, {  5,     71,   3,  12 }, {  5,     55,   4,   7 },
+    {  1,   8536,   5,   6 }, { -1,      0,   0,   0 }, { -1,      1,   0,   0 }, {  2,     20,   8,  11 },
+    {  4,   1452,   9,  10 }, { -1,      0,   0,   0 }, { -1,      1,   0,   0 }, { -1,      1,   0,   0 },
+    {  1,   6476,  13,  18 }, {  2,     20,  14,  17 }, {  1,   5052,  15,  16 }, { -1,      0,   0,   0 },
+    { -1,      1,   0,   0 }, { -1,      1,   0,   0 }, { -1,      1,   0,   0 }, { -1,      1,   0,   0 },
+    {  5,     48,  21,  26 }, {  2,     51,  22,  25 }, {  1,   3418,  23,  24 }, { -1,      0,   0,   0 },
+    { -1,      1,   0,   0 }, { -1,      1,   0,   0 }, { -1,      1,   0,   0 },
+};
+
+static const x264_model_node_t partition_model_b_split[15] =
+{
+    {  7,      0,   1,  14 }, { 10,      0,   2,  13 }, {  1,   5032,   3,  12 }, {  1,   2878,   4,   7 },
+    {  5,     21,   5,   6 }, { -1,      0,   0,   0 }, { -1,      1,   0,   0 }, {  0,     36,   8,   9 },
+    { -1,      1,   0,   0 }, {  2,     38,  10,  11 }, { -1,      0,   0,   0 }, { -1,      1,   0,   0 },
+    { -1,      1,   0,   0 }, { -1,      1,   0,   0 }, { -1,      1,   0,   0 },
+};
+
+static const x264_model_node_t partition_model_b_intra[17] =
+{
+    {  8,      2,   1,  16 }, {  8,      0,   2,  11 }, {  1,   7524,   3,  10 }, {  5,     67,   4,   5 },
+    { -1,      0,   0,   0 }, {  2,     38,   6,   9 }, {  5,    107,   7,   8 }, { -1,      0,   0,   0 },
+    { -1,      1,   0,   0 }, { -1,      1,   0,   0 }, { -1,      1,   0,   0 }, {  5,     57,  12,  15 },
+    {  5,     26,  13,  14 }, { -1,      0,   0,   0 }, { -1,      1,   0,   0 }, { -1,      1,   0,   0 },
+    { -1,      1,   0,   0 },
+};
@@ -352,6 +352,80 @@ do\
     x264_macroblock_cache_mvd( h, block_idx_x[idx], block_idx_y[idx], width, height, i_list, mvd );\
 } while( 0 )
 
+#if !RDO_SKIP_BS
+/* Fill in the mvd cache exactly as the header writers below would, without coding anything.
+ * Used when entropy coding runs on its own thread: the next macroblock's contexts can't
+ * wait for the entropy thread to catch up. */
+static void cache_mvd( x264_t *h, int i_list, int idx, int width, int height )
+{
+    ALIGNED_4( int16_t mvp[2] );
+    x264_mb_predict_mv( h, i_list, idx, width, mvp );
+    int mdx = abs( h->mb.cache.mv[i_list][x264_scan8[idx]][0] - mvp[0] );
+    int mdy = abs( h->mb.cache.mv[i_list][x264_scan8[idx]][1] - mvp[1] );
+    x264_macroblock_cache_mvd( h, block_idx_x[idx], block_idx_y[idx], width, height, i_list,
+                               pack8to16( X264_MIN( mdx, 66 ), X264_MIN( mdy, 66 ) ) );
+}
+
+void x264_cabac_mb_mvd( x264_t *h )
+{
+    const int i_mb_type = h->mb.i_type;
+    if( i_mb_type == P_8x8 )
+    {
+        for( int i = 0; i < 4; i++ )
+            switch( h->mb.i_sub_partition[i] )
+            {
+                case D_L0_8x8:
+                    cache_mvd( h, 0, 4*i, 2, 2 );
+                    break;
+                case D_L0_8x4:
+                    cache_mvd( h, 0, 4*i+0, 2, 1 );
+                    cache_mvd( h, 0, 4*i+2, 2, 1 );
+                    break;
+                case D_L0_4x8:
+                    cache_mvd( h, 0, 4*i+0, 1, 2 );
+                    cache_mvd( h, 0, 4*i+1, 1, 2 );
+                    break;
+                case D_L0_4x4:
+                    cache_mvd( h, 0, 4*i+0, 1, 1 );
+                    cache_mvd( h, 0, 4*i+1, 1, 1 );
+                    cache_mvd( h, 0, 4*i+2, 1, 1 );
+                    cache_mvd( h, 0, 4*i+3, 1, 1 );
+                    break;
+                default:
+                    assert(0);
+            }
+    }
+    else if( i_mb_type == B_8x8 )
+    {
+        for( int i_list = 0; i_list < 2; i_list++ )
+            for( int i = 0; i < 4; i++ )
+                if( x264_mb_partition_listX_table[i_list][ h->mb.i_sub_partition[i] ] )
+                    cache_mvd( h, i_list, 4*i, 2, 2 );
+    }
+    else if( i_mb_type == P_L0 || (i_mb_type >= B_L0_L0 && i_mb_type <= B_BI_BI) )
+    {
+        const uint8_t (*b_list)[2] = x264_mb_type_list_table[i_mb_type];
+        for( int i_list = 0; i_list < 2; i_list++ )
+        {
+            if( h->mb.i_partition == D_16x16 )
+            {
+                if( b_list[i_list][0] ) cache_mvd( h, i_list, 0, 4, 4 );
+            }
+            else if( h->mb.i_partition == D_16x8 )
+            {
+                if( b_list[i_list][0] ) cache_mvd( h, i_list, 0, 4, 2 );
+                if( b_list[i_list][1] ) cache_mvd( h, i_list, 8, 4, 2 );
+            }
+            else //if( h->mb.i_partition == D_8x16 )
+            {
+                if( b_list[i_list][0] ) cache_mvd( h, i_list, 0, 2, 4 );
+                if( b_list[i_list][1] ) cache_mvd( h, i_list, 4, 2, 4 );
+            }
+        }
+    }
+}
+#endif
+
 static inline void cabac_8x8_mvd( x264_t *h, x264_cabac_t *cb, int i )
 {
     switch( h->mb.i_sub_partition[i] )
@@ -71,13 +71,23 @@ static double calc_ssim_db( double ssim )
     return -10.0 * log10( inv_ssim );
 }
 
+/* round up to use the whole mb row */
+static int mv_range_thread_round( int r )
+{
+    int r2 = (r & ~15) + ((-X264_THREAD_HEIGHT) & 15);
+    if( r2 < r )
+        r2 += 16;
+    return r2;
+}
+
 static int threadpool_wait_all( x264_t *h )
 {
-    for( int i = 0; i < h->param.i_threads; i++ )
-        if( h->thread[i]->b_thread_active )
+    /* A sliced frame thread encodes its first slice itself, and is waited on as a frame. */
+    for( int i = h->i_thread_frames > 1; i < h->i_slice_threads; i++ )
+        if( h->slice_thread[i]->b_thread_active )
         {
-            h->thread[i]->b_thread_active = 0;
-            if( (intptr_t)x264_threadpool_wait( h->threadpool, h->thread[i] ) < 0 )
+            h->slice_thread[i]->b_thread_active = 0;
+            if( (intptr_t)x264_threadpool_wait( h->threadpool, h->slice_thread[i] ) < 0 )
                 return -1;
         }
     return 0;
@@ -414,6 +424,465 @@ static void encoder_thread_init( x264_t *h )
 }
 #endif
 
+#if HAVE_THREAD
+/****************************************************************************
+ * Entropy thread: analysis queues one x264_entropy_mb_t per macroblock and
+ * a dedicated thread per encoding context runs the CABAC writer on them.
+ ****************************************************************************/
+static void entropy_mb_residual( x264_t *h, x264_entropy_mb_t *m, int b_load )
+{
+#define COPY( field ) b_load ? memcpy( h->dct.field, m->field, sizeof(m->field) ) \
+                             : memcpy( m->field, h->dct.field, sizeof(m->field) )
+    int plane_count = CHROMA444 ? 3 : 1;
+    if( m->i_type == I_16x16 )
+        for( int p = 0; p < plane_count; p++ )
+            COPY( luma16x16_dc[p] );
+    if( m->b_transform_8x8 )
+    {
+        for( int p = 0; p < plane_count; p++ )
+            FOREACH_BIT( i, 0, m->i_cbp_luma )
+                COPY( luma8x8[i+p*4] );
+    }
+    else
+    {
+        for( int p = 0; p < plane_count; p++ )
+            FOREACH_BIT( i8x8, 0, m->i_cbp_luma )
+                for( int i = 0; i < 4; i++ )
+                    COPY( luma4x4[i+i8x8*4+p*16] );
+    }
+    if( !CHROMA444 && m->i_cbp_chroma )
+    {
+        COPY( chroma_dc );
+        if( m->i_cbp_chroma == 2 )
+            for( int i = 16; i < 3*16; i += 8 << CHROMA_V_SHIFT )
+                for( int j = i; j < i+4; j++ )
+                    COPY( luma4x4[j] );
+    }
+#undef COPY
+}
+
+static void entropy_mb_save( x264_t *h, x264_entropy_mb_t *m )
+{
+    m->i_type = h->mb.i_type;
+    m->i_mb_x = h->mb.i_mb_x;
+    m->i_mb_y = h->mb.i_mb_y;
+    m->i_neighbour_skip = h->mb.cache.i_neighbour_skip;
+    if( IS_SKIP( m->i_type ) )
+        return;
+
+    m->i_partition = h->mb.i_partition;
+    CP32( m->i_sub_partition, h->mb.i_sub_partition );
+    m->i_cbp_luma = h->mb.i_cbp_luma;
+    m->i_cbp_chroma = h->mb.i_cbp_chroma;
+    m->b_transform_8x8 = h->mb.b_transform_8x8;
+    m->i_intra16x16_pred_mode = h->mb.i_intra16x16_pred_mode;
+    m->i_chroma_pred_mode = h->mb.i_chroma_pred_mode;
+    m->i_qp = h->mb.i_qp;
+    m->i_last_qp = h->mb.i_last_qp;
+    m->i_last_dqp = h->mb.i_last_dqp;
+
+    m->i_neighbour = h->mb.i_neighbour;
+    m->i_mb_type_top = h->mb.i_mb_type_top;
+    m->i_mb_type_left[0] = h->mb.i_mb_type_left[0];
+    m->i_mb_type_left[1] = h->mb.i_mb_type_left[1];
+    m->i_mb_prev_xy = h->mb.i_mb_prev_xy;
+    m->i_mb_left_xy[0] = h->mb.i_mb_left_xy[0];
+    m->i_mb_left_xy[1] = h->mb.i_mb_left_xy[1];
+    m->i_mb_top_xy = h->mb.i_mb_top_xy;
+
+    m->i_neighbour_transform_size = h->mb.cache.i_neighbour_transform_size;
+    m->i_cbp_top = h->mb.cache.i_cbp_top;
+    m->i_cbp_left = h->mb.cache.i_cbp_left;
+    memcpy( m->intra4x4_pred_mode, h->mb.cache.intra4x4_pred_mode, sizeof(m->intra4x4_pred_mode) );
+    memcpy( m->non_zero_count, h->mb.cache.non_zero_count, sizeof(m->non_zero_count) );
+    if( h->sh.i_type != SLICE_TYPE_I )
+    {
+        int i_list_count = h->sh.i_type == SLICE_TYPE_B ? 2 : 1;
+        memcpy( m->ref, h->mb.cache.ref, i_list_count * sizeof(m->ref[0]) );
+        memcpy( m->mv, h->mb.cache.mv, i_list_count * sizeof(m->mv[0]) );
+        memcpy( m->mvd, h->mb.cache.mvd, i_list_count * sizeof(m->mvd[0]) );
+        memcpy( m->skip, h->mb.cache.skip, sizeof(m->skip) );
+    }
+
+    if( m->i_type == I_PCM )
+    {
+        pixel *pcm = (pixel*)m->luma8x8;
+        for( int p = 0; p < 3; p++ )
+            memcpy( pcm + p*256, h->mb.pic.p_fenc[p], 256 * sizeof(pixel) );
+    }
+    else
+        entropy_mb_residual( h, m, 0 );
+}
+
+static void entropy_mb_load( x264_t *h, x264_entropy_mb_t *m )
+{
+    h->mb.i_type = m->i_type;
+    h->mb.i_mb_x = m->i_mb_x;
+    h->mb.i_mb_y = m->i_mb_y;
+    h->mb.i_mb_xy = m->i_mb_y * h->mb.i_mb_stride + m->i_mb_x;
+    h->mb.cache.i_neighbour_skip = m->i_neighbour_skip;
+    if( IS_SKIP( m->i_type ) )
+        return;
+
+    h->mb.i_partition = m->i_partition;
+    CP32( h->mb.i_sub_partition, m->i_sub_partition );
+    h->mb.i_cbp_luma = m->i_cbp_luma;
+    h->mb.i_cbp_chroma = m->i_cbp_chroma;
+    h->mb.b_transform_8x8 = m->b_transform_8x8;
+    h->mb.i_intra16x16_pred_mode = m->i_intra16x16_pred_mode;
+    h->mb.i_chroma_pred_mode = m->i_chroma_pred_mode;
+    h->mb.i_qp = m->i_qp;
+    h->mb.i_last_qp = m->i_last_qp;
+    h->mb.i_last_dqp = m->i_last_dqp;
+
+    h->mb.i_neighbour = m->i_neighbour;
+    h->mb.i_mb_type_top = m->i_mb_type_top;
+    h->mb.i_mb_type_left[0] = m->i_mb_type_left[0];
+    h->mb.i_mb_type_left[1] = m->i_mb_type_left[1];
+    h->mb.i_mb_prev_xy = m->i_mb_prev_xy;
+    h->mb.i_mb_left_xy[0] = m->i_mb_left_xy[0];
+    h->mb.i_mb_left_xy[1] = m->i_mb_left_xy[1];
+    h->mb.i_mb_top_xy = m->i_mb_top_xy;
+
+    h->mb.cache.i_neighbour_transform_size = m->i_neighbour_transform_size;
+    h->mb.cache.i_cbp_top = m->i_cbp_top;
+    h->mb.cache.i_cbp_left = m->i_cbp_left;
+    memcpy( h->mb.cache.intra4x4_pred_mode, m->intra4x4_pred_mode, sizeof(m->intra4x4_pred_mode) );
+    memcpy( h->mb.cache.non_zero_count, m->non_zero_count, sizeof(m->non_zero_count) );
+    if( h->sh.i_type != SLICE_TYPE_I )
+    {
+        int i_list_count = h->sh.i_type == SLICE_TYPE_B ? 2 : 1;
+        memcpy( h->mb.cache.ref, m->ref, i_list_count * sizeof(m->ref[0]) );
+        memcpy( h->mb.cache.mv, m->mv, i_list_count * sizeof(m->mv[0]) );
+        memcpy( h->mb.cache.mvd, m->mvd, i_list_count * sizeof(m->mvd[0]) );
+        memcpy( h->mb.cache.skip, m->skip, sizeof(m->skip) );
+    }
+
+    if( m->i_type == I_PCM )
+    {
+        pixel *pcm = (pixel*)m->luma8x8;
+        for( int p = 0; p < 3; p++ )
+            h->mb.pic.p_fenc[p] = pcm + p*256;
+    }
+    else
+        entropy_mb_residual( h, m, 1 );
+}
+
+static void entropy_mb_write( x264_t *h, x264_entropy_t *e, x264_entropy_mb_t *m )
+{
+    entropy_mb_load( h, m );
+
+    if( m->i_mb_x == 0 && bitstream_check_buffer( h ) )
+        e->b_error = 1;
+    if( e->b_error )
+        return;
+
+    int mb_spos = x264_cabac_pos( &h->cabac );
+    if( h->mb.i_mb_xy > h->sh.i_first_mb )
+        x264_cabac_encode_terminal( &h->cabac );
+
+    if( IS_SKIP( h->mb.i_type ) )
+        x264_cabac_mb_skip( h, 1 );
+    else
+    {
+        if( h->sh.i_type != SLICE_TYPE_I )
+            x264_cabac_mb_skip( h, 0 );
+        x264_macroblock_write_cabac( h, &h->cabac );
+    }
+    e->row_bits[m->i_mb_y] += x264_cabac_pos( &h->cabac ) - mb_spos;
+}
+
+static void *entropy_thread_internal( x264_entropy_t *e )
+{
+    x264_t *h = e->h;
+    x264_pthread_mutex_lock( &e->mutex );
+    while( 1 )
+    {
+        while( e->i_read == e->i_write && !e->b_exit_thread )
+            x264_pthread_cond_wait( &e->cv_fill, &e->mutex );
+        if( e->i_read == e->i_write )
+            break;
+        int i_read = e->i_read;
+        int i_write = e->i_write;
+        x264_pthread_mutex_unlock( &e->mutex );
+
+        int i_row_done = -1;
+        for( ; i_read < i_write; i_read++ )
+        {
+            x264_entropy_mb_t *m = &e->mb[i_read % e->i_size];
+            entropy_mb_write( h, e, m );
+            if( m->i_mb_x == h->mb.i_mb_width - 1 )
+            {
+                memcpy( e->row_state[m->i_mb_y % X264_ENTROPY_ROWS], h->cabac.state, sizeof(h->cabac.state) );
+                i_row_done = m->i_mb_y;
+                i_read++;
+                break;
+            }
+        }
+
+        x264_pthread_mutex_lock( &e->mutex );
+        e->i_read = i_read;
+        if( i_row_done >= 0 )
+            e->i_row_done = i_row_done;
+        x264_pthread_cond_broadcast( &e->cv_empty );
+    }
+    x264_pthread_mutex_unlock( &e->mutex );
+    return NULL;
+}
+
+static void *entropy_thread( x264_entropy_t *e )
+{
+    return (void*)x264_stack_align( entropy_thread_internal, e );
+}
+
+static int entropy_init( x264_t *h )
+{
+    x264_entropy_t *e;
+    CHECKED_MALLOCZERO( e, sizeof(x264_entropy_t) );
+    h->entropy = e;
+    e->i_size = X264_ENTROPY_ROWS * h->mb.i_mb_width;
+    CHECKED_MALLOC( e->h, sizeof(x264_t) );
+    CHECKED_MALLOC( e->mb, e->i_size * sizeof(x264_entropy_mb_t) );
+    CHECKED_MALLOC( e->row_bits, h->mb.i_mb_height * sizeof(int) );
+    CHECKED_MALLOC( e->row_state, X264_ENTROPY_ROWS * sizeof(*e->row_state) );
+    if( x264_pthread_mutex_init( &e->mutex, NULL ) ||
+        x264_pthread_cond_init( &e->cv_fill, NULL ) ||
+        x264_pthread_cond_init( &e->cv_empty, NULL ) )
+        return -1;
+    if( x264_pthread_create( &e->thread_handle, NULL, (void*)entropy_thread, e ) )
+        return -1;
+    e->b_thread_active = 1;
+    return 0;
+fail:
+    return -1;
+}
+
+static void entropy_delete( x264_t *h )
+{
+    x264_entropy_t *e = h->entropy;
+    if( !e )
+        return;
+    if( e->b_thread_active )
+    {
+        x264_pthread_mutex_lock( &e->mutex );
+        e->b_exit_thread = 1;
+        x264_pthread_cond_broadcast( &e->cv_fill );
+        x264_pthread_mutex_unlock( &e->mutex );
+        x264_pthread_join( e->thread_handle, NULL );
+        x264_pthread_mutex_destroy( &e->mutex );
+        x264_pthread_cond_destroy( &e->cv_fill );
+        x264_pthread_cond_destroy( &e->cv_empty );
+    }
+    x264_free( e->h );
+    x264_free( e->mb );
+    x264_free( e->row_bits );
+    x264_free( e->row_state );
+    x264_free( e );
+    h->entropy = NULL;
+}
+
+/* Called once the CABAC encoder has been initialized for the slice. */
+static void entropy_slice_start( x264_t *h )
+{
+    x264_entropy_t *e = h->entropy;
+    /* The entropy thread is idle between slices, so its context can just be replaced. */
+    *e->h = *h;
+    e->h->stat.frame.i_mv_bits = 0;
+    e->h->stat.frame.i_tex_bits = 0;
+    memset( e->row_bits, 0, h->mb.i_mb_height * sizeof(int) );
+    x264_pthread_mutex_lock( &e->mutex );
+    e->i_read = e->i_write = 0;
+    e->i_row_done = -1;
+    e->b_error = 0;
+    x264_pthread_mutex_unlock( &e->mutex );
+}
+
+/* RD and trellis read the CABAC contexts, which only the entropy thread keeps up to date.
+ * Rather than waiting on it for every macroblock, each row is analysed with the contexts
+ * as they stood two rows earlier, which keeps the output independent of thread timing. */
+static void entropy_row_sync( x264_t *h, int i_mb_y )
+{
+    x264_entropy_t *e = h->entropy;
+    int i_row = i_mb_y - 2;
+    if( i_row < h->sh.i_first_mb / h->mb.i_mb_width )
+        return;
+    x264_pthread_mutex_lock( &e->mutex );
+    while( e->i_row_done < i_row )
+        x264_pthread_cond_wait( &e->cv_empty, &e->mutex );
+    x264_pthread_mutex_unlock( &e->mutex );
+    memcpy( h->cabac.state, e->row_state[i_row % X264_ENTROPY_ROWS], sizeof(h->cabac.state) );
+}
+
+static void entropy_mb_push( x264_t *h )
+{
+    x264_entropy_t *e = h->entropy;
+
+    /* cabac_qp_delta() and cabac_mvd() modify the macroblock as they code it, and the
+     * next macroblock depends on that through x264_macroblock_cache_save(). */
+    if( h->mb.i_type == I_16x16 && !h->mb.cbp[h->mb.i_mb_xy] && h->mb.i_qp > h->mb.i_last_qp )
+        h->mb.i_qp = h->mb.i_last_qp;
+    if( h->sh.i_type != SLICE_TYPE_I )
+        x264_cabac_mb_mvd( h );
+
+    x264_pthread_mutex_lock( &e->mutex );
+    while( e->i_write - e->i_read >= e->i_size )
+        x264_pthread_cond_wait( &e->cv_empty, &e->mutex );
+    x264_pthread_mutex_unlock( &e->mutex );
+
+    entropy_mb_save( h, &e->mb[e->i_write % e->i_size] );
+
+    x264_pthread_mutex_lock( &e->mutex );
+    e->i_write++;
+    x264_pthread_cond_broadcast( &e->cv_fill );
+    x264_pthread_mutex_unlock( &e->mutex );
+}
+
+static int entropy_slice_end( x264_t *h )
+{
+    x264_entropy_t *e = h->entropy;
+    x264_t *eh = e->h;
+    x264_pthread_mutex_lock( &e->mutex );
+    while( e->i_read < e->i_write )
+        x264_pthread_cond_wait( &e->cv_empty, &e->mutex );
+    x264_pthread_mutex_unlock( &e->mutex );
+
+    /* The entropy thread may have reallocated the bitstream buffer. */
+    h->out.p_bitstream = eh->out.p_bitstream;
+    h->out.i_bitstream = eh->out.i_bitstream;
+    h->out.bs = eh->out.bs;
+    if( e->b_error )
+        return -1;
+    memcpy( &h->cabac, &eh->cabac, sizeof(x264_cabac_t) );
+    h->stat.frame.i_mv_bits += eh->stat.frame.i_mv_bits;
+    h->stat.frame.i_tex_bits += eh->stat.frame.i_tex_bits;
+    for( int y = h->sh.i_first_mb / h->mb.i_mb_width; y <= h->sh.i_last_mb / h->mb.i_mb_width; y++ )
+        h->fdec->i_row_bits[y] += e->row_bits[y];
+    return 0;
+}
+
+static void fdec_filter_row( x264_t *h, int mb_y, int pass );
+
+static void *filter_thread_internal( x264_filter_thread_t *f )
+{
+    x264_pthread_mutex_lock( &f->mutex );
+    while( 1 )
+    {
+        while( !f->b_exit_thread && (f->i_row_next < 0 || f->i_row_next >= f->i_row_end) )
+            x264_pthread_cond_wait( &f->cv_fill, &f->mutex );
+        if( f->b_exit_thread )
+            break;
+        int i_row_next = f->i_row_next;
+        int i_row_end = f->i_row_end;
+        x264_pthread_mutex_unlock( &f->mutex );
+
+        /* Each call deblocks the row above mb_y, hpels what is now final and signals
+         * dependent frame threads through x264_frame_cond_broadcast. */
+        for( ; i_row_next < i_row_end; i_row_next++ )
+            fdec_filter_row( f->h, i_row_next, 0 );
+
+        x264_pthread_mutex_lock( &f->mutex );
+        f->i_row_next = i_row_next;
+        x264_pthread_cond_broadcast( &f->cv_empty );
+    }
+    x264_pthread_mutex_unlock( &f->mutex );
+    return NULL;
+}
+
+static void *filter_thread( x264_filter_thread_t *f )
+{
+    return (void*)x264_stack_align( filter_thread_internal, f );
+}
+
+static int filter_thread_init( x264_t *h )
+{
+    x264_filter_thread_t *f;
+    CHECKED_MALLOCZERO( f, sizeof(x264_filter_thread_t) );
+    h->filter = f;
+    f->i_row_next = -1;
+    CHECKED_MALLOC( f->h, sizeof(x264_t) );
+    /* fdec_filter_row() uses the scratch buffer for hpel and ssim. */
+    int buf_hpel = (h->thread[0]->fdec->i_width[0]+48+32) * sizeof(int16_t);
+    int buf_ssim = h->param.analyse.b_ssim * 8 * (h->param.i_width/4+3) * sizeof(int);
+    CHECKED_MALLOC( f->scratch_buffer, X264_MAX( buf_hpel, buf_ssim ) );
+    if( x264_pthread_mutex_init( &f->mutex, NULL ) ||
+        x264_pthread_cond_init( &f->cv_fill, NULL ) ||
+        x264_pthread_cond_init( &f->cv_empty, NULL ) )
+        return -1;
+    if( x264_pthread_create( &f->thread_handle, NULL, (void*)filter_thread, f ) )
+        return -1;
+    f->b_thread_active = 1;
+    return 0;
+fail:
+    return -1;
+}
+
+static void filter_thread_delete( x264_t *h )
+{
+    x264_filter_thread_t *f = h->filter;
+    if( !f )
+        return;
+    if( f->b_thread_active )
+    {
+        x264_pthread_mutex_lock( &f->mutex );
+        f->b_exit_thread = 1;
+        x264_pthread_cond_broadcast( &f->cv_fill );
+        x264_pthread_mutex_unlock( &f->mutex );
+        x264_pthread_join( f->thread_handle, NULL );
+        x264_pthread_mutex_destroy( &f->mutex );
+        x264_pthread_cond_destroy( &f->cv_fill );
+        x264_pthread_cond_destroy( &f->cv_empty );
+    }
+    x264_free( f->h );
+    x264_free( f->scratch_buffer );
+    x264_free( f );
+    h->filter = NULL;
+}
+
+/* Wait for the queued rows and fold the quality metrics measured on them back into h. */
+static void filter_thread_sync( x264_t *h )
+{
+    x264_filter_thread_t *f = h->filter;
+    x264_t *fh = f->h;
+    x264_pthread_mutex_lock( &f->mutex );
+    while( f->i_row_next >= 0 && f->i_row_next < f->i_row_end )
+        x264_pthread_cond_wait( &f->cv_empty, &f->mutex );
+    f->i_row_next = -1;
+    x264_pthread_mutex_unlock( &f->mutex );
+
+    for( int p = 0; p < 3; p++ )
+    {
+        h->stat.frame.i_ssd[p] += fh->stat.frame.i_ssd[p];
+        fh->stat.frame.i_ssd[p] = 0;
+    }
+    h->stat.frame.f_ssim += fh->stat.frame.f_ssim;
+    h->stat.frame.i_ssim_cnt += fh->stat.frame.i_ssim_cnt;
+    fh->stat.frame.f_ssim = 0;
+    fh->stat.frame.i_ssim_cnt = 0;
+}
+
+static void filter_thread_slice_start( x264_t *h )
+{
+    x264_filter_thread_t *f = h->filter;
+    /* The filter thread is idle between slices, so its context can just be replaced. */
+    *f->h = *h;
+    f->h->scratch_buffer = f->scratch_buffer;
+    memset( f->h->stat.frame.i_ssd, 0, sizeof(f->h->stat.frame.i_ssd) );
+    f->h->stat.frame.f_ssim = 0;
+    f->h->stat.frame.i_ssim_cnt = 0;
+}
+
+static void filter_thread_push( x264_t *h, int mb_y )
+{
+    x264_filter_thread_t *f = h->filter;
+    x264_pthread_mutex_lock( &f->mutex );
+    if( f->i_row_next < 0 )
+        f->i_row_next = mb_y;
+    f->i_row_end = mb_y + 1;
+    x264_pthread_cond_broadcast( &f->cv_fill );
+    x264_pthread_mutex_unlock( &f->mutex );
+}
+#endif
+
 /****************************************************************************
  *
  ****************************************************************************
@@ -538,6 +1007,15 @@ static int validate_parameters( x264_t *h, int b_open )
         h->param.vui.i_sar_height = 0;
     }
 
+    /* Lookahead-only mode has no frames to encode in parallel: give all threads to the lookahead. */
+    if( h->param.b_lookahead_only )
+    {
+        h->param.b_sliced_threads = 1;
+        h->param.i_sliced_frames = 1;
+        h->param.rc.b_stat_read = 0;
+        h->param.rc.b_stat_write = 0;
+    }
+
     if( h->param.i_threads == X264_THREADS_AUTO )
     {
         h->param.i_threads = x264_cpu_num_processors() * (h->param.b_sliced_threads?2:3)/2;
@@ -556,7 +1034,7 @@ static int validate_parameters( x264_t *h, int b_open )
         /* Avoid absurdly small thread slices as they can reduce performance
          * and VBV compliance.  Capped at an arbitrary 4 rows per thread. */
         if( h->param.b_sliced_threads )
-            h->param.i_threads = X264_MIN( h->param.i_threads, max_sliced_threads );
+            h->param.i_threads = X264_MIN( h->param.i_threads, max_sliced_threads * X264_MAX( h->param.i_sliced_frames, 1 ) );
     }
     h->param.i_threads = x264_clip3( h->param.i_threads, 1, X264_THREAD_MAX );
     if( h->param.i_threads == 1 )
@@ -564,7 +1042,11 @@ static int validate_parameters( x264_t *h, int b_open )
         h->param.b_sliced_threads = 0;
         h->param.i_lookahead_threads = 1;
     }
-    h->i_thread_frames = h->param.b_sliced_threads ? 1 : h->param.i_threads;
+    /* Sliced frames: a few frame threads, each splitting its frame across the same number of slice threads. */
+    h->param.i_sliced_frames = h->param.b_sliced_threads ? x264_clip3( h->param.i_sliced_frames, 1, h->param.i_threads ) : 1;
+    h->param.i_threads -= h->param.i_threads % h->param.i_sliced_frames;
+    h->i_thread_frames = h->param.b_sliced_threads ? h->param.i_sliced_frames : h->param.i_threads;
+    h->i_slice_threads = h->param.i_threads / h->i_thread_frames;
     if( h->i_thread_frames > 1 )
         h->param.nalu_process = NULL;
 
@@ -867,13 +1349,14 @@ static int validate_parameters( x264_t *h, int b_open )
         if( h->param.b_sliced_threads )
         {
             if( res )
-                h->param.i_threads = X264_MIN( 2, h->param.i_threads );
+                h->i_slice_threads = X264_MIN( 2, h->i_slice_threads );
             else
             {
-                h->param.i_threads = X264_MIN( 5, h->param.i_threads );
-                if( h->param.i_threads < 5 )
-                    h->param.i_threads = 1;
+                h->i_slice_threads = X264_MIN( 5, h->i_slice_threads );
+                if( h->i_slice_threads < 5 )
+                    h->i_slice_threads = 1;
             }
+            h->param.i_threads = h->i_slice_threads * h->i_thread_frames;
         }
 
         if( type )
@@ -1029,7 +1512,7 @@ static int validate_parameters( x264_t *h, int b_open )
 
     int max_slices = (h->param.i_height+((16<<PARAM_INTERLACED)-1))/(16<<PARAM_INTERLACED);
     if( h->param.b_sliced_threads )
-        h->param.i_slice_count = x264_clip3( h->param.i_threads, 0, max_slices );
+        h->param.i_slice_count = x264_clip3( h->i_slice_threads, 0, max_slices );
     else
     {
         h->param.i_slice_count = x264_clip3( h->param.i_slice_count, 0, max_slices );
@@ -1123,6 +1606,14 @@ static int validate_parameters( x264_t *h, int b_open )
     }
     if( b_open && h->param.rc.b_stat_read )
         h->param.rc.i_lookahead = 0;
+    if( !h->param.rc.b_mb_tree || !h->param.rc.i_lookahead )
+        h->param.rc.i_incremental_lookahead = 0;
+    h->param.rc.i_incremental_lookahead = x264_clip3( h->param.rc.i_incremental_lookahead, 0, X264_LOOKAHEAD_MAX );
+    /* The coarse plane is only used for scenecut and b-adapt decisions. */
+    if( h->param.rc.b_stat_read || (!h->param.i_scenecut_threshold && !h->param.i_bframe_adaptive) )
+        h->param.rc.b_coarse_lookahead = 0;
+    if( h->param.rc.b_stat_read || !h->param.i_scenecut_threshold )
+        h->param.b_scenecut_prefilter = 0;
 #if HAVE_THREAD
     if( h->param.i_sync_lookahead < 0 )
         h->param.i_sync_lookahead = h->param.i_bframe + 1;
@@ -1144,7 +1635,7 @@ static int validate_parameters( x264_t *h, int b_open )
         h->param.i_cqm_preset = X264_CQM_FLAT;
 
     if( h->param.analyse.i_me_method < X264_ME_DIA ||
-        h->param.analyse.i_me_method > X264_ME_TESA )
+        h->param.analyse.i_me_method > X264_ME_EPZS )
         h->param.analyse.i_me_method = X264_ME_HEX;
     h->param.analyse.i_me_range = x264_clip3( h->param.analyse.i_me_range, 4, 1024 );
     if( h->param.analyse.i_me_range > 16 && h->param.analyse.i_me_method <= X264_ME_HEX )
@@ -1164,6 +1655,8 @@ static int validate_parameters( x264_t *h, int b_open )
         h->param.analyse.intra &= ~X264_ANALYSE_I8x8;
     }
     h->param.analyse.i_trellis = x264_clip3( h->param.analyse.i_trellis, 0, 2 );
+    h->param.analyse.i_dup_skip = x264_clip3( h->param.analyse.i_dup_skip, 0, 2 );
+    h->param.analyse.i_intra_gradient = x264_clip3( h->param.analyse.i_intra_gradient, 0, 8 );
 
     if( h->param.analyse.i_weighted_pred == X264_WEIGHTP_NONE )
         h->param.rc.f_fade_compensate += 0.1;
@@ -1298,11 +1791,16 @@ static int validate_parameters( x264_t *h, int b_open )
 
     if( PARAM_INTERLACED )
     {
-        if( h->param.analyse.i_me_method >= X264_ME_ESA )
+        if( ME_EXHAUSTIVE( h->param.analyse.i_me_method ) )
         {
             x264_log( h, X264_LOG_WARNING, "interlace + me=esa is not implemented\n" );
             h->param.analyse.i_me_method = X264_ME_UMH;
         }
+        if( h->param.analyse.b_hash_me )
+        {
+            x264_log( h, X264_LOG_WARNING, "interlace + hash-me is not implemented\n" );
+            h->param.analyse.b_hash_me = 0;
+        }
         if( h->param.analyse.i_weighted_pred > 0 )
         {
             x264_log( h, X264_LOG_WARNING, "interlace + weightp is not implemented\n" );
@@ -1331,11 +1829,17 @@ static int validate_parameters( x264_t *h, int b_open )
             h->param.rc.f_pb_factor = 1 + (h->param.rc.f_pb_factor - 1) / pow(h->param.analyse.i_fgo, 0.3);
         }
     }
+    if( h->param.analyse.b_partition_model && h->param.analyse.psz_partition_log )
+    {
+        x264_log( h, X264_LOG_WARNING, "partition-log needs the decisions partition-model would skip, disabling partition-model\n" );
+        h->param.analyse.b_partition_model = 0;
+    }
 
     if( h->i_thread_frames > 1 )
     {
         int r = h->param.analyse.i_mv_range_thread;
         int r2;
+        h->b_mv_range_thread_auto = r <= 0;
         if( r <= 0 )
         {
             // half of the available space is reserved and divided evenly among the threads,
@@ -1347,10 +1851,7 @@ static int validate_parameters( x264_t *h, int b_open )
         }
         r = X264_MAX( r, h->param.analyse.i_me_range );
         r = X264_MIN( r, h->param.analyse.i_mv_range );
-        // round up to use the whole mb row
-        r2 = (r & ~15) + ((-X264_THREAD_HEIGHT) & 15);
-        if( r2 < r )
-            r2 += 16;
+        r2 = mv_range_thread_round( r );
         x264_log( h, X264_LOG_DEBUG, "using mv_range_thread = %d\n", r2 );
         h->param.analyse.i_mv_range_thread = r2;
     }
@@ -1382,6 +1883,38 @@ static int validate_parameters( x264_t *h, int b_open )
     if( h->param.i_nal_hrd == X264_NAL_HRD_CBR )
         h->param.rc.b_filler = 1;
 
+    if( h->param.b_entropy_thread )
+    {
+#if !HAVE_THREAD
+        x264_log( h, X264_LOG_WARNING, "not compiled with thread support!\n");
+        h->param.b_entropy_thread = 0;
+#endif
+        /* VBV and slice-max-size need the size of each macroblock before the next one is analysed. */
+        if( !h->param.b_cabac || PARAM_INTERLACED || h->param.i_slice_max_size || h->param.rc.i_vbv_buffer_size )
+        {
+            x264_log( h, X264_LOG_WARNING, "entropy-thread requires CABAC and is incompatible with interlacing, VBV and slice-max-size\n" );
+            h->param.b_entropy_thread = 0;
+        }
+        /* RD and trellis only see the CABAC contexts from two rows back. */
+        else if( h->param.analyse.i_subpel_refine >= 6 || h->param.analyse.i_trellis )
+            x264_log( h, X264_LOG_WARNING, "entropy-thread with subme >= 6 or trellis loses compression, see doc/threads.txt\n" );
+    }
+
+    if( h->param.b_filter_thread )
+    {
+#if !HAVE_THREAD
+        x264_log( h, X264_LOG_WARNING, "not compiled with thread support!\n");
+        h->param.b_filter_thread = 0;
+#endif
+        /* Sliced threads already split filtering into passes, and MBAFF swaps the intra
+         * border backup as part of each filtered row. */
+        if( h->param.b_sliced_threads || PARAM_INTERLACED )
+        {
+            x264_log( h, X264_LOG_WARNING, "filter-thread is incompatible with sliced threads and interlacing\n" );
+            h->param.b_filter_thread = 0;
+        }
+    }
+
     /* ensure the booleans are 0 or 1 so they can be used in math */
 #define BOOLIFY(x) h->param.x = !!h->param.x
     BOOLIFY( b_cabac );
@@ -1389,8 +1922,12 @@ static int validate_parameters( x264_t *h, int b_open )
     BOOLIFY( b_deblocking_filter );
     BOOLIFY( b_deterministic );
     BOOLIFY( b_sliced_threads );
+    BOOLIFY( b_entropy_thread );
+    BOOLIFY( b_filter_thread );
     BOOLIFY( b_interlaced );
     BOOLIFY( b_intra_refresh );
+    BOOLIFY( b_scenecut_prefilter );
+    BOOLIFY( b_lookahead_only );
     BOOLIFY( b_aud );
     BOOLIFY( b_repeat_headers );
     BOOLIFY( b_annexb );
@@ -1407,8 +1944,11 @@ static int validate_parameters( x264_t *h, int b_open )
     BOOLIFY( analyse.b_transform_8x8 );
     BOOLIFY( analyse.b_weighted_bipred );
     BOOLIFY( analyse.b_chroma_me );
+    BOOLIFY( analyse.b_hash_me );
     BOOLIFY( analyse.b_mixed_references );
     BOOLIFY( analyse.b_fast_pskip );
+    BOOLIFY( analyse.b_static_skip );
+    BOOLIFY( analyse.b_partition_model );
     BOOLIFY( analyse.b_dct_decimate );
     BOOLIFY( analyse.b_psy );
     BOOLIFY( analyse.b_psnr );
@@ -1416,6 +1956,7 @@ static int validate_parameters( x264_t *h, int b_open )
     BOOLIFY( rc.b_stat_write );
     BOOLIFY( rc.b_stat_read );
     BOOLIFY( rc.b_mb_tree );
+    BOOLIFY( rc.b_coarse_lookahead );
     BOOLIFY( rc.b_filler );
 #undef BOOLIFY
 
@@ -1515,6 +2056,17 @@ static void set_aspect_ratio( x264_t *h, x264_param_t *param, int initial )
     }
 }
 
+static void partition_log_close( x264_t *h )
+{
+    if( !h->partition_log )
+        return;
+    if( h->partition_log->fh )
+        fclose( h->partition_log->fh );
+    x264_pthread_mutex_destroy( &h->partition_log->mutex );
+    x264_free( h->partition_log );
+    h->partition_log = NULL;
+}
+
 /****************************************************************************
  * x264_encoder_open:
  ****************************************************************************/
@@ -1613,13 +2165,16 @@ x264_t *x264_encoder_open( x264_param_t *param )
     h->frames.i_max_ref1 = X264_MIN( h->sps->vui.i_num_reorder_frames, h->param.i_frame_reference );
     h->frames.i_max_dpb  = h->sps->vui.i_max_dec_frame_buffering;
     h->frames.b_have_lowres = !h->param.rc.b_stat_read
-        && ( h->param.rc.i_rc_method == X264_RC_ABR
+        && ( h->param.b_lookahead_only
+          || h->param.rc.i_rc_method == X264_RC_ABR
           || h->param.rc.i_rc_method == X264_RC_CRF
           || h->param.i_bframe_adaptive
           || h->param.i_scenecut_threshold
           || h->param.rc.b_mb_tree
           || h->param.analyse.i_weighted_pred );
     h->frames.b_have_lowres |= h->param.rc.b_stat_read && h->param.rc.i_vbv_buffer_size > 0;
+    h->frames.b_have_lowres |= h->param.analyse.b_static_skip || h->param.analyse.i_dup_skip;
+    h->frames.b_have_coarse = h->frames.b_have_lowres && h->param.rc.b_coarse_lookahead;
     h->frames.b_have_sub8x8_esa = !!(h->param.analyse.inter & X264_ANALYSE_PSUB8x8);
 
     h->frames.i_last_idr =
@@ -1746,6 +2301,24 @@ x264_t *x264_encoder_open( x264_param_t *param )
     }
 #endif
 
+    if( h->param.analyse.psz_partition_log )
+    {
+        CHECKED_MALLOCZERO( h->partition_log, sizeof(x264_partition_log_t) );
+        if( x264_pthread_mutex_init( &h->partition_log->mutex, NULL ) )
+        {
+            x264_free( h->partition_log );
+            h->partition_log = NULL;
+            goto fail;
+        }
+        h->partition_log->fh = x264_fopen( h->param.analyse.psz_partition_log, "w" );
+        if( !h->partition_log->fh )
+        {
+            x264_log( h, X264_LOG_ERROR, "partition_log: can't write to %s\n", h->param.analyse.psz_partition_log );
+            goto fail;
+        }
+        x264_analyse_model_log_header( h );
+    }
+
     h->thread[0] = h;
     for( int i = 1; i < h->param.i_threads + !!h->param.i_sync_lookahead; i++ )
         CHECKED_MALLOC( h->thread[i], sizeof(x264_t) );
@@ -1754,15 +2327,20 @@ x264_t *x264_encoder_open( x264_param_t *param )
         {
             CHECKED_MALLOC( h->lookahead_thread[i], sizeof(x264_t) );
             *h->lookahead_thread[i] = *h;
+            if( x264_macroblock_thread_allocate( h->lookahead_thread[i], 1 ) < 0 )
+                goto fail;
         }
     *h->reconfig_h = *h;
 
+    /* The first i_thread_frames contexts each encode a frame. With sliced threads the rest
+     * are split evenly between them to encode the other slices, sharing their frame data. */
     for( int i = 0; i < h->param.i_threads; i++ )
     {
         int init_nal_count = h->param.i_slice_count + 3;
-        int allocate_threadlocal_data = !h->param.b_sliced_threads || !i;
+        int allocate_threadlocal_data = i < h->i_thread_frames;
+        x264_t *frame_thread = allocate_threadlocal_data ? h : h->thread[(i - h->i_thread_frames) / (h->i_slice_threads - 1)];
         if( i > 0 )
-            *h->thread[i] = *h;
+            *h->thread[i] = *frame_thread;
 
         if( x264_pthread_mutex_init( &h->thread[i]->mutex, NULL ) )
             goto fail;
@@ -1776,7 +2354,7 @@ x264_t *x264_encoder_open( x264_param_t *param )
                 goto fail;
         }
         else
-            h->thread[i]->fdec = h->thread[0]->fdec;
+            h->thread[i]->fdec = frame_thread->fdec;
 
         CHECKED_MALLOC( h->thread[i]->out.p_bitstream, h->out.i_bitstream );
         /* Start each thread with room for init_nal_count NAL units; it'll realloc later if needed. */
@@ -1786,6 +2364,15 @@ x264_t *x264_encoder_open( x264_param_t *param )
         if( allocate_threadlocal_data && x264_macroblock_cache_allocate( h->thread[i] ) < 0 )
             goto fail;
     }
+    for( int i = 0; i < h->i_thread_frames; i++ )
+    {
+        x264_t *t = h->thread[i];
+        t->slice_thread[0] = t;
+        for( int j = 1; j < h->i_slice_threads; j++ )
+            t->slice_thread[j] = h->thread[h->i_thread_frames + i * (h->i_slice_threads - 1) + j - 1];
+        for( int j = 1; j < h->i_slice_threads; j++ )
+            memcpy( t->slice_thread[j]->slice_thread, t->slice_thread, sizeof(t->slice_thread) );
+    }
 
 #if HAVE_OPENCL
     if( h->param.b_opencl && x264_opencl_lookahead_init( h ) < 0 )
@@ -1799,6 +2386,17 @@ x264_t *x264_encoder_open( x264_param_t *param )
         if( x264_macroblock_thread_allocate( h->thread[i], 0 ) < 0 )
             goto fail;
 
+#if HAVE_THREAD
+    if( h->param.b_entropy_thread )
+        for( int i = 0; i < h->param.i_threads; i++ )
+            if( entropy_init( h->thread[i] ) < 0 )
+                goto fail;
+    if( h->param.b_filter_thread )
+        for( int i = 0; i < h->param.i_threads; i++ )
+            if( filter_thread_init( h->thread[i] ) < 0 )
+                goto fail;
+#endif
+
     if( x264_ratecontrol_new( h ) < 0 )
         goto fail;
 
@@ -1852,6 +2450,7 @@ x264_t *x264_encoder_open( x264_param_t *param )
 
     return h;
 fail:
+    partition_log_close( h );
     x264_free( h );
     return NULL;
 }
@@ -1874,7 +2473,7 @@ static int encoder_try_reconfig( x264_t *h, x264_param_t *param, int *rc_reconfi
     COPY( analyse.intra );
     COPY( analyse.i_direct_mv_pred );
     /* Scratch buffer prevents me_range from being increased for esa/tesa */
-    if( h->param.analyse.i_me_method < X264_ME_ESA || param->analyse.i_me_range < h->param.analyse.i_me_range )
+    if( !ME_EXHAUSTIVE( h->param.analyse.i_me_method ) || param->analyse.i_me_range < h->param.analyse.i_me_range )
         COPY( analyse.i_me_range );
     COPY( analyse.i_noise_reduction );
     /* We can't switch out of subme=0 during encoding. */
@@ -1890,9 +2489,9 @@ static int encoder_try_reconfig( x264_t *h, x264_param_t *param, int *rc_reconfi
     COPY( analyse.i_fgo );
     COPY( crop_rect );
     // can only twiddle these if they were enabled to begin with:
-    if( h->param.analyse.i_me_method >= X264_ME_ESA || param->analyse.i_me_method < X264_ME_ESA )
+    if( ME_EXHAUSTIVE( h->param.analyse.i_me_method ) || !ME_EXHAUSTIVE( param->analyse.i_me_method ) )
         COPY( analyse.i_me_method );
-    if( h->param.analyse.i_me_method >= X264_ME_ESA && !h->frames.b_have_sub8x8_esa )
+    if( ME_EXHAUSTIVE( h->param.analyse.i_me_method ) && !h->frames.b_have_sub8x8_esa )
         h->param.analyse.inter &= ~X264_ANALYSE_PSUB8x8;
     if( h->pps->b_transform_8x8_mode )
         COPY( analyse.b_transform_8x8 );
@@ -2404,6 +3003,49 @@ static inline void reference_build_list( x264_t *h, int i_poc )
     h->mb.pic.i_fref[1] = h->i_ref[1];
 }
 
+/* A fixed mv_range_thread either makes frame threads wait for rows that low-motion frames
+ * never reference, or clamps the vertical motion of fast ones. In auto mode, size it per
+ * frame from the vertical motion the lookahead found instead. */
+static void mv_range_thread_update( x264_t *h )
+{
+    x264_frame_t *fenc = h->fenc;
+    int hist[256] = {0};
+    int count = 0;
+    int dist = 1;
+
+    fenc->i_mv_range_thread = h->param.analyse.i_mv_range_thread;
+    if( !h->b_mv_range_thread_auto || !h->i_ref[0] )
+        return;
+
+    for( int l = 0; l < 2; l++ )
+        for( int j = 0; j < h->i_ref[l]; j++ )
+            dist = X264_MAX( dist, reference_distance( h, h->fref[l][j] ) );
+
+    /* Vertical motion per frame of distance, in full-res pixels. */
+    for( int l = 0; l <= !!h->param.i_bframe; l++ )
+        for( int d = 0; d <= h->param.i_bframe; d++ )
+        {
+            int16_t (*mvs)[2] = fenc->lowres_mvs[l][d];
+            if( !mvs || mvs[0][0] == 0x7FFF )
+                continue;
+            for( int i = 0; i < h->mb.i_mb_count; i++ )
+                hist[X264_MIN( (abs( mvs[i][1] ) >> 1) / (d+1), 255 )]++;
+            count += h->mb.i_mb_count;
+        }
+    if( !count )
+        return;
+
+    /* Leave out the fastest 1% of blocks: the lowres search finds spurious long vectors
+     * in flat areas, and the few real ones left out are only clamped. */
+    int v = 255;
+    for( int sum = hist[v]; v > 0 && sum <= count / 100; )
+        sum += hist[--v];
+
+    int r = v * dist + h->param.analyse.i_me_range;
+    r = x264_clip3( r, h->param.analyse.i_me_range, h->param.analyse.i_mv_range );
+    fenc->i_mv_range_thread = mv_range_thread_round( r );
+}
+
 static void fdec_filter_row( x264_t *h, int mb_y, int pass )
 {
     /* mb_y is the mb to be encoded next, not the mb to be filtered here */
@@ -2481,7 +3123,7 @@ static void fdec_filter_row( x264_t *h, int mb_y, int pass )
             XCHG( pixel *, h->intra_border_backup[1][i], h->intra_border_backup[4][i] );
         }
 
-    if( h->i_thread_frames > 1 && h->fdec->b_kept_as_ref )
+    if( h->i_thread_frames > 1 && !h->param.b_sliced_threads && h->fdec->b_kept_as_ref )
         x264_frame_cond_broadcast( h->fdec, mb_y*16 + (b_end ? 10000 : -(X264_THREAD_HEIGHT << SLICE_MBAFF)) );
 
     if( b_measure_quality )
@@ -2758,6 +3400,14 @@ static intptr_t slice_write( x264_t *h )
     int starting_bits = bs_pos(&h->out.bs);
     int b_deblock = h->sh.i_disable_deblocking_filter_idc != 1;
     int b_hpel = h->fdec->b_kept_as_ref;
+#if HAVE_THREAD
+    /* Re-encoding for VBV or slice-max-size needs each macroblock's size immediately. */
+    int b_entropy_thread = h->entropy && !slice_max_size && !h->param.rc.i_vbv_buffer_size;
+    int b_filter_thread = !!h->filter;
+#else
+    int b_entropy_thread = 0;
+    int b_filter_thread = 0;
+#endif
     int orig_last_mb = h->sh.i_last_mb;
     int thread_last_mb = h->i_threadslice_end * h->mb.i_mb_width - 1;
     uint8_t *last_emu_check;
@@ -2798,6 +3448,15 @@ static intptr_t slice_write( x264_t *h )
     h->mb.i_last_qp = h->sh.i_qp;
     h->mb.i_last_dqp = 0;
     h->mb.field_decoding_flag = 0;
+#if HAVE_THREAD
+    if( b_entropy_thread )
+        entropy_slice_start( h );
+    if( b_filter_thread )
+    {
+        filter_thread_sync( h );
+        filter_thread_slice_start( h );
+    }
+#endif
 
     i_mb_y = h->sh.i_first_mb / h->mb.i_mb_width;
     i_mb_x = h->sh.i_first_mb % h->mb.i_mb_width;
@@ -2810,12 +3469,24 @@ static intptr_t slice_write( x264_t *h )
 
         if( i_mb_x == 0 )
         {
+#if HAVE_THREAD
+            if( b_entropy_thread )
+                entropy_row_sync( h, i_mb_y );
+            else
+#endif
             if( bitstream_check_buffer( h ) )
                 return -1;
             if( !(i_mb_y & SLICE_MBAFF) && h->param.rc.i_vbv_buffer_size )
                 bitstream_backup( h, &bs_bak[BS_BAK_ROW_VBV], i_skip, 1 );
             if( !h->mb.b_reencode_mb )
+            {
+#if HAVE_THREAD
+                if( b_filter_thread )
+                    filter_thread_push( h, i_mb_y );
+                else
+#endif
                 fdec_filter_row( h, i_mb_y, 0 );
+            }
         }
 
         if( back_up_bitstream )
@@ -2858,6 +3529,11 @@ static intptr_t slice_write( x264_t *h )
 reencode:
         x264_macroblock_encode( h );
 
+#if HAVE_THREAD
+        if( b_entropy_thread )
+            entropy_mb_push( h );
+        else
+#endif
         if( h->param.b_cabac )
         {
             if( mb_xy > h->sh.i_first_mb && !(SLICE_MBAFF && (i_mb_y&1)) )
@@ -3066,6 +3742,10 @@ cont:
             i_mb_x = 0;
         }
     }
+#if HAVE_THREAD
+    if( b_entropy_thread && entropy_slice_end( h ) < 0 )
+        return -1;
+#endif
     if( h->sh.i_last_mb < h->sh.i_first_mb )
         return 0;
 
@@ -3093,6 +3773,14 @@ cont:
                                   + (h->out.i_nal*NALU_OVERHEAD * 8)
                                   - h->stat.frame.i_tex_bits
                                   - h->stat.frame.i_mv_bits;
+#if HAVE_THREAD
+        if( b_filter_thread )
+        {
+            filter_thread_push( h, h->i_threadslice_end );
+            filter_thread_sync( h );
+        }
+        else
+#endif
         fdec_filter_row( h, h->i_threadslice_end, 0 );
 
         if( h->param.b_sliced_threads )
@@ -3106,13 +3794,23 @@ cont:
             /* Do the first row of hpel, now that the previous slice is done */
             if( h->i_thread_idx > 0 )
             {
-                x264_threadslice_cond_wait( h->thread[h->i_thread_idx-1], 2 );
+                x264_threadslice_cond_wait( h->slice_thread[h->i_thread_idx-1], 2 );
                 fdec_filter_row( h, h->i_threadslice_start + (1 << SLICE_MBAFF), 2 );
             }
+            /* Slices finish out of order, so only hand rows to the other frame threads
+             * once every slice above is done too. */
+            if( h->i_thread_frames > 1 && h->fdec->b_kept_as_ref )
+            {
+                if( h->i_thread_idx > 0 )
+                    x264_threadslice_cond_wait( h->slice_thread[h->i_thread_idx-1], 3 );
+                int b_last = h->i_threadslice_end == h->mb.i_mb_height;
+                x264_frame_cond_broadcast( h->fdec, h->i_threadslice_end*16 + (b_last ? 10000 : -(X264_THREAD_HEIGHT << SLICE_MBAFF)) );
+                x264_threadslice_cond_broadcast( h, 3 );
+            }
         }
 
         /* Free mb info after the last thread's done using it */
-        if( h->fdec->mb_info_free && (!h->param.b_sliced_threads || h->i_thread_idx == (h->param.i_threads-1)) )
+        if( h->fdec->mb_info_free && (!h->param.b_sliced_threads || h->i_thread_idx == (h->i_slice_threads-1)) )
         {
             h->fdec->mb_info_free( h->fdec->mb_info );
             h->fdec->mb_info = NULL;
@@ -3155,6 +3853,10 @@ static void *slices_write( x264_t *h )
     int i_slice_num = 0;
     int last_thread_mb = h->sh.i_last_mb;
 
+    /* Done before any row is handed to the other frame threads. */
+    if( h->fdec->hash_head && h->fdec->b_kept_as_ref && !h->param.b_sliced_threads )
+        x264_frame_hash_init( h->fdec, h->fenc );
+
     /* init stats */
     memset( &h->stat.frame, 0, sizeof(h->stat.frame) );
     h->mb.b_reencode_mb = 0;
@@ -3205,51 +3907,107 @@ static void *slices_write( x264_t *h )
 fail:
     /* Tell other threads we're done, so they wouldn't wait for it */
     if( h->param.b_sliced_threads )
-        x264_threadslice_cond_broadcast( h, 2 );
+        x264_threadslice_cond_broadcast( h, 3 );
     return (void *)-1;
 }
 
-static int threaded_slices_write( x264_t *h )
+/* Split the frame into one slice per thread. The frame takes as long as its slowest slice,
+ * so when the lookahead has costed the frame, the boundaries are placed to even out the
+ * estimated work rather than the number of rows. */
+static void threadslice_boundaries( x264_t *h, int *slice_start )
+{
+    int height = h->mb.i_mb_height >> PARAM_INTERLACED;
+    int n = h->i_slice_threads;
+    int *row_cost = h->scratch_buffer2;
+
+    for( int i = 0; i <= n; i++ )
+        slice_start[i] = (height * i + h->param.i_slice_count/2) / n;
+    if( !x264_slicetype_row_costs( h, row_cost ) )
+        return;
+
+    for( int y = 0; y < height; y++ )
+        row_cost[y] = row_cost[y<<PARAM_INTERLACED] + (PARAM_INTERLACED ? row_cost[2*y+1] : 0);
+    int64_t total = 0;
+    for( int y = 0; y < height; y++ )
+        total += row_cost[y];
+    /* Every macroblock takes some time regardless of its residual cost; give each row a
+     * share of the average so that nearly static rows don't end up in one huge slice. */
+    int row_base = total / height / 2 + 1;
+    total += (int64_t)row_base * height;
+
+    /* End each slice on the row that gets closest to its share of the cost. Tiny slices
+     * hurt VBV compliance, so keep at least half the even split of rows in each. */
+    int min_rows = X264_MAX( height / (2*n), 1 );
+    int64_t cost = 0;
+    for( int y = 0, i = 1; i < n; y++ )
+    {
+        int cur = row_cost[y] + row_base;
+        int rows_left = height - (y+1);
+        cost += cur;
+        if( y+1 - slice_start[i-1] < min_rows || rows_left < (n-i) * min_rows )
+            continue;
+        if( (cost - cur/2) * n >= total * i || rows_left == (n-i) * min_rows )
+            slice_start[i++] = y+1;
+    }
+}
+
+static void *threaded_slices_write( x264_t *h )
 {
+    int slice_start[X264_THREAD_MAX+1];
+    threadslice_boundaries( h, slice_start );
+
+    if( h->fdec->hash_head && h->fdec->b_kept_as_ref )
+        x264_frame_hash_init( h->fdec, h->fenc );
+
     /* set first/last mb and sync contexts */
-    for( int i = 0; i < h->param.i_threads; i++ )
+    for( int i = 0; i < h->i_slice_threads; i++ )
     {
-        x264_t *t = h->thread[i];
+        x264_t *t = h->slice_thread[i];
         if( i )
         {
             t->param = h->param;
             memcpy( &t->i_frame, &h->i_frame, offsetof(x264_t, rc) - offsetof(x264_t, i_frame) );
         }
-        int height = h->mb.i_mb_height >> PARAM_INTERLACED;
-        t->i_threadslice_start = ((height *  i    + h->param.i_slice_count/2) / h->param.i_threads) << PARAM_INTERLACED;
-        t->i_threadslice_end   = ((height * (i+1) + h->param.i_slice_count/2) / h->param.i_threads) << PARAM_INTERLACED;
+        t->i_threadslice_start = slice_start[i]   << PARAM_INTERLACED;
+        t->i_threadslice_end   = slice_start[i+1] << PARAM_INTERLACED;
         t->sh.i_first_mb = t->i_threadslice_start * h->mb.i_mb_width;
         t->sh.i_last_mb  =   t->i_threadslice_end * h->mb.i_mb_width - 1;
     }
 
+    /* With sliced frames, the weighted references may still be encoding on other frame threads. */
+    if( h->i_thread_frames > 1 )
+        for( int j = 0; j < h->i_ref[0]; j++ )
+            if( h->sh.weight[j][0].weightfn )
+                x264_frame_cond_wait( h->fref[0][j]->orig, h->mb.i_mb_height*16 + 10000 );
     x264_analyse_weight_frame( h, h->mb.i_mb_height*16 + 16 );
 
     x264_threads_distribute_ratecontrol( h );
 
+    /* A sliced frame thread is already running on the pool, so it encodes the first slice itself. */
+    int first_job = h->i_thread_frames > 1;
+
     /* setup */
-    for( int i = 0; i < h->param.i_threads; i++ )
+    for( int i = 0; i < h->i_slice_threads; i++ )
     {
-        h->thread[i]->i_thread_idx = i;
-        h->thread[i]->b_thread_active = 1;
-        x264_threadslice_cond_broadcast( h->thread[i], 0 );
+        h->slice_thread[i]->i_thread_idx = i;
+        if( i >= first_job )
+            h->slice_thread[i]->b_thread_active = 1;
+        x264_threadslice_cond_broadcast( h->slice_thread[i], 0 );
     }
     /* dispatch */
-    for( int i = 0; i < h->param.i_threads; i++ )
-        x264_threadpool_run( h->threadpool, (void*)slices_write, h->thread[i] );
+    for( int i = first_job; i < h->i_slice_threads; i++ )
+        x264_threadpool_run( h->threadpool, (void*)slices_write, h->slice_thread[i] );
+    if( first_job && (intptr_t)slices_write( h ) )
+        return (void *)-1;
     /* wait */
-    for( int i = 0; i < h->param.i_threads; i++ )
-        x264_threadslice_cond_wait( h->thread[i], 1 );
+    for( int i = 0; i < h->i_slice_threads; i++ )
+        x264_threadslice_cond_wait( h->slice_thread[i], 1 );
 
     x264_threads_merge_ratecontrol( h );
 
-    for( int i = 1; i < h->param.i_threads; i++ )
+    for( int i = 1; i < h->i_slice_threads; i++ )
     {
-        x264_t *t = h->thread[i];
+        x264_t *t = h->slice_thread[i];
         for( int j = 0; j < t->out.i_nal; j++ )
         {
             h->out.nal[h->out.i_nal] = t->out.nal[j];
@@ -3265,7 +4023,7 @@ static int threaded_slices_write( x264_t *h )
         h->stat.frame.i_ssim_cnt += t->stat.frame.i_ssim_cnt;
     }
 
-    return 0;
+    return (void *)0;
 }
 
 void x264_encoder_intra_refresh( x264_t *h )
@@ -3298,6 +4056,38 @@ int x264_encoder_invalidate_reference( x264_t *h, int64_t pts )
     return 0;
 }
 
+/* Lookahead-only mode: return the lookahead's results for the frame instead of encoding it. */
+static int lookahead_only_frame_end( x264_t *h, x264_picture_t *pic_out )
+{
+    x264_frame_t *fenc = h->fenc;
+
+    pic_out->i_type = fenc->i_type;
+    pic_out->b_keyframe = fenc->b_keyframe;
+    pic_out->i_pic_struct = fenc->i_pic_struct;
+    pic_out->i_pts = fenc->i_pts;
+    if( h->frames.i_bframe_delay )
+    {
+        int64_t *prev_reordered_pts = h->frames.i_prev_reordered_pts;
+        pic_out->i_dts = h->i_frame > h->frames.i_bframe_delay
+                       ? prev_reordered_pts[ (h->i_frame - h->frames.i_bframe_delay) % h->frames.i_bframe_delay ]
+                       : fenc->i_reordered_pts - h->frames.i_bframe_delay_time;
+        prev_reordered_pts[ h->i_frame % h->frames.i_bframe_delay ] = fenc->i_reordered_pts;
+    }
+    else
+        pic_out->i_dts = fenc->i_reordered_pts;
+    pic_out->opaque = fenc->opaque;
+    pic_out->img.i_plane = 0;
+
+    pic_out->prop.i_lookahead_cost = fenc->i_decided_cost;
+    pic_out->prop.i_lookahead_intra_cost = fenc->i_cost_est[0][0];
+    pic_out->prop.f_lookahead_intra_mbs = fenc->f_decided_intra_mbs;
+    /* The frame isn't reused before the next input picture arrives. */
+    pic_out->prop.lookahead_qp_offsets = fenc->f_qp_offset;
+
+    x264_frame_push_unused( h, fenc );
+    return 0;
+}
+
 /****************************************************************************
  * x264_encoder_encode:
  *  XXX: i_poc   : is the poc of the current given picture
@@ -3331,6 +4121,9 @@ int     x264_encoder_encode( x264_t *h,
         h->i_thread_phase = (h->i_thread_phase + 1) % h->i_thread_frames;
         thread_current = h->thread[ h->i_thread_phase ];
         thread_oldest  = h->thread[ (h->i_thread_phase + 1) % h->i_thread_frames ];
+        /* Sliced frames: the slice threads may still be filtering this context's last frame. */
+        if( h->param.b_sliced_threads && threadpool_wait_all( thread_current ) < 0 )
+            return -1;
         thread_sync_context( thread_current, thread_prev );
         x264_thread_sync_ratecontrol( thread_current, thread_prev, thread_oldest );
         h = thread_current;
@@ -3444,6 +4237,9 @@ int     x264_encoder_encode( x264_t *h,
     /* 4: get picture to encode */
     h->fenc = x264_frame_shift( h->frames.current );
 
+    if( h->param.b_lookahead_only )
+        return lookahead_only_frame_end( h, pic_out );
+
     /* If applicable, wait for previous frame reconstruction to finish */
     if( h->param.b_sliced_threads )
         if( threadpool_wait_all( h ) < 0 )
@@ -3571,15 +4367,25 @@ int     x264_encoder_encode( x264_t *h,
     /* ------------------- Init                ----------------------------- */
     /* build ref list 0/1 */
     reference_build_list( h, h->fdec->i_poc );
+    /* The lookahead's static map and duplicate check only hold against the references they were measured on. */
+    if( h->fenc->i_static_ref[0] >= 0 && (h->fref[0][0]->i_frame != h->fenc->i_static_ref[0] ||
+        (h->fenc->i_static_ref[1] >= 0 && h->fref[1][0]->i_frame != h->fenc->i_static_ref[1])) )
+    {
+        h->fenc->i_static_ref[0] = -1;
+        h->fenc->i_duplicate = 0;
+    }
+    if( h->i_thread_frames > 1 )
+        mv_range_thread_update( h );
 
     /* ---------------------- Write the bitstream -------------------------- */
     /* Init bitstream context */
     if( h->param.b_sliced_threads )
     {
-        for( int i = 0; i < h->param.i_threads; i++ )
+        for( int i = 0; i < h->i_slice_threads; i++ )
         {
-            bs_init( &h->thread[i]->out.bs, h->thread[i]->out.p_bitstream, h->thread[i]->out.i_bitstream );
-            h->thread[i]->out.i_nal = 0;
+            x264_t *t = h->slice_thread[i];
+            bs_init( &t->out.bs, t->out.p_bitstream, t->out.i_bitstream );
+            t->out.i_nal = 0;
         }
     }
     else
@@ -3852,12 +4658,12 @@ int     x264_encoder_encode( x264_t *h,
     h->i_threadslice_end = h->mb.i_mb_height;
     if( h->i_thread_frames > 1 )
     {
-        x264_threadpool_run( h->threadpool, (void*)slices_write, h );
+        x264_threadpool_run( h->threadpool, h->param.b_sliced_threads ? (void*)threaded_slices_write : (void*)slices_write, h );
         h->b_thread_active = 1;
     }
     else if( h->param.b_sliced_threads )
     {
-        if( threaded_slices_write( h ) )
+        if( (intptr_t)threaded_slices_write( h ) )
             return -1;
     }
     else
@@ -3873,7 +4679,7 @@ static int encoder_frame_end( x264_t *h, x264_t *thread_current,
 {
     char psz_message[80];
 
-    if( !h->param.b_sliced_threads && h->b_thread_active )
+    if( h->i_thread_frames > 1 && h->b_thread_active )
     {
         h->b_thread_active = 0;
         if( (intptr_t)x264_threadpool_wait( h->threadpool, h ) )
@@ -4033,6 +4839,8 @@ static int encoder_frame_end( x264_t *h, x264_t *thread_current,
                 h->stat.i_mb_count_ref[h->sh.i_type][i_list][i] += h->stat.frame.i_mb_count_ref[i_list][i];
     for( int i = 0; i < 3; i++ )
         h->stat.i_mb_field[i] += h->stat.frame.i_mb_field[i];
+    for( int i = 0; i < 2; i++ )
+        h->stat.i_rd_cache[i] += h->stat.frame.i_rd_cache[i];
     if( h->sh.i_type == SLICE_TYPE_P && h->param.analyse.i_weighted_pred >= X264_WEIGHTP_SIMPLE )
     {
         h->stat.i_wpred[0] += !!h->sh.weight[0][0].weightfn;
@@ -4174,7 +4982,13 @@ void    x264_encoder_close  ( x264_t *h )
 #endif
 
     if( h->param.b_sliced_threads )
-        threadpool_wait_all( h );
+        for( int i = 0; i < h->i_thread_frames; i++ )
+        {
+            /* A frame still in flight needs its slice jobs to run before the pool goes away. */
+            if( h->i_thread_frames > 1 && h->thread[i]->b_thread_active )
+                x264_threadpool_wait( h->threadpool, h->thread[i] );
+            threadpool_wait_all( h->thread[i] );
+        }
     if( h->param.i_threads > 1 )
         x264_threadpool_delete( h->threadpool );
     if( h->param.i_lookahead_threads > 1 )
@@ -4456,11 +5270,17 @@ void    x264_encoder_close  ( x264_t *h )
         }
         else
             x264_log( h, X264_LOG_INFO, "kb/s:%.2f\n", f_bitrate );
+
+        if( h->stat.i_rd_cache[0] )
+            x264_log( h, X264_LOG_DEBUG, "rd cache: %"PRId64" mb rd evaluations, %.1f%% reused\n",
+                      h->stat.i_rd_cache[0], 100. * h->stat.i_rd_cache[1] / h->stat.i_rd_cache[0] );
     }
 
     /* rc */
     x264_ratecontrol_delete( h );
 
+    partition_log_close( h );
+
     /* param */
     if( h->param.rc.psz_stat_out )
         free( h->param.rc.psz_stat_out );
@@ -4492,13 +5312,16 @@ void    x264_encoder_close  ( x264_t *h )
 
     if( h->param.i_lookahead_threads > 1 )
         for( int i = 0; i < h->param.i_lookahead_threads; i++ )
+        {
+            x264_macroblock_thread_free( h->lookahead_thread[i], 1 );
             x264_free( h->lookahead_thread[i] );
+        }
 
     for( int i = h->param.i_threads - 1; i >= 0; i-- )
     {
         x264_frame_t **frame;
 
-        if( !h->param.b_sliced_threads || i == 0 )
+        if( i < h->i_thread_frames )
         {
             for( frame = h->thread[i]->frames.reference; *frame; frame++ )
             {
@@ -4517,6 +5340,10 @@ void    x264_encoder_close  ( x264_t *h )
             }
             x264_macroblock_cache_free( h->thread[i] );
         }
+#if HAVE_THREAD
+        entropy_delete( h->thread[i] );
+        filter_thread_delete( h->thread[i] );
+#endif
         x264_macroblock_thread_free( h->thread[i], 0 );
         x264_free( h->thread[i]->out.p_bitstream );
         x264_free( h->thread[i]->out.nal );
@@ -65,6 +65,8 @@ void x264_mb_encode_chroma( x264_t *h, int b_inter, int i_qp );
 
 #define x264_cabac_mb_skip x264_template(cabac_mb_skip)
 void x264_cabac_mb_skip( x264_t *h, int b_skip );
+#define x264_cabac_mb_mvd x264_template(cabac_mb_mvd)
+void x264_cabac_mb_mvd( x264_t *h );
 #define x264_cabac_block_residual_c x264_template(cabac_block_residual_c)
 void x264_cabac_block_residual_c( x264_t *h, x264_cabac_t *cb, int ctx_block_cat, dctcoef *l );
 #define x264_cabac_block_residual_8x8_rd_c x264_template(cabac_block_residual_8x8_rd_c)
@@ -54,6 +54,14 @@ static const uint8_t mod6m1[8] = {5,0,1,2,3,4,5,0};
 /* radius 2 hexagon. repeated entries are to avoid having to compute mod6 every time. */
 static const int8_t hex2[8][2] = {{-1,-2}, {-2,0}, {-1,2}, {1,2}, {2,0}, {1,-2}, {-1,-2}, {-2,0}};
 static const int8_t square1[9][2] = {{0,0}, {0,-1}, {0,1}, {-1,0}, {1,0}, {-1,-1}, {-1,1}, {1,-1}, {1,1}};
+/* radius 4 hexagon, in the order of the x4 batches */
+static const int8_t hex4[16][2] = {
+    { 0,-4}, { 0, 4}, {-2,-3}, { 2,-3},
+    {-4,-2}, { 4,-2}, {-4,-1}, { 4,-1},
+    {-4, 0}, { 4, 0}, {-4, 1}, { 4, 1},
+    {-4, 2}, { 4, 2}, {-2, 3}, { 2, 3},
+};
+static const uint8_t pixel_size_shift[7] = { 0, 1, 1, 2, 3, 3, 4 };
 
 static void refine_subpel( x264_t *h, x264_me_t *m, int hpel_iters, int qpel_iters, int *p_halfpel_thresh, int b_refine_qpel );
 
@@ -175,17 +183,43 @@ do\
     }\
 }
 
+/* Append to mvc up to HASH_ME_CANDIDATES fullpel mvs at which ref holds an exact copy of
+ * the 8x8 block of fenc at (x,y), as far as the hash can tell.  Returns the new count. */
+int x264_me_hash_predictors( x264_t *h, x264_frame_t *ref, pixel *fenc, int x, int y, int16_t (*mvc)[2], int i_mvc )
+{
+    uint32_t key = x264_frame_hash_block( fenc, FENC_STRIDE );
+    int width = ref->i_width[0];
+    int i_max = i_mvc + HASH_ME_CANDIDATES;
+    int probes = 16;
+    for( int pos = ref->hash_head[key >> (32 - HASH_ME_BITS)]; pos >= 0 && i_mvc < i_max && probes--; pos = ref->hash_next[pos] )
+    {
+        if( ref->hash_key[pos] != key )
+            continue;
+        int mx = pos % width - x;
+        int my = pos / width - y;
+        if( mx < h->mb.mv_limit_fpel[0][0] || mx > h->mb.mv_limit_fpel[1][0] ||
+            my < h->mb.mv_limit_fpel[0][1] || my > h->mb.mv_limit_fpel[1][1] )
+            continue;
+        uint32_t mv = pack16to32_mask( mx*4, my*4 );
+        int i = 0;
+        while( i < i_mvc && M32( mvc[i] ) != mv )
+            i++;
+        if( i == i_mvc )
+            M32( mvc[i_mvc++] ) = mv;
+    }
+    return i_mvc;
+}
+
 #define FPEL(mv) (((mv)+2)>>2) /* Convert subpel MV to fullpel with rounding... */
 #define SPEL(mv) ((mv)<<2)     /* ... and the reverse. */
 #define SPELx2(mv) (SPEL(mv)&0xFFFCFFFC) /* for two packed MVs */
 
-void x264_me_search_ref( x264_t *h, x264_me_t *m, int16_t (*mvc)[2], int i_mvc, int *p_halfpel_thresh )
+void x264_me_search_ref( x264_t *h, x264_me_t *m, int16_t (*mvc)[2], int i_mvc, int *p_halfpel_thresh, int i_me_range )
 {
     const int bw = x264_pixel_size[m->i_pixel].w;
     const int bh = x264_pixel_size[m->i_pixel].h;
     const int i_pixel = m->i_pixel;
     const int stride = m->i_stride[0];
-    int i_me_range = h->param.analyse.i_me_range;
     int bmx, bmy, bcost = COST_MAX;
     int bpred_cost = COST_MAX;
     int omx, omy, pmx, pmy;
@@ -424,8 +458,6 @@ void x264_me_search_ref( x264_t *h, x264_me_t *m, int16_t (*mvc)[2], int i_mvc,
             /* Uneven-cross Multi-Hexagon-grid Search
              * as in JM, except with different early termination */
 
-            static const uint8_t pixel_size_shift[7] = { 0, 1, 1, 2, 3, 3, 4 };
-
             int ucost1, ucost2;
             int cross_start = 1;
 
@@ -531,13 +563,6 @@ void x264_me_search_ref( x264_t *h, x264_me_t *m, int16_t (*mvc)[2], int i_mvc,
             int i = 1;
             do
             {
-                static const int8_t hex4[16][2] = {
-                    { 0,-4}, { 0, 4}, {-2,-3}, { 2,-3},
-                    {-4,-2}, { 4,-2}, {-4,-1}, { 4,-1},
-                    {-4, 0}, { 4, 0}, {-4, 1}, { 4, 1},
-                    {-4, 2}, { 4, 2}, {-2, 3}, { 2, 3},
-                };
-
                 if( 4*i > X264_MIN4( mv_x_max-omx, omx-mv_x_min,
                                      mv_y_max-omy, omy-mv_y_min ) )
                 {
@@ -615,6 +640,66 @@ void x264_me_search_ref( x264_t *h, x264_me_t *m, int16_t (*mvc)[2], int i_mvc,
             break;
         }
 
+        case X264_ME_EPZS:
+        {
+            /* Enhanced Predictive Zonal Search, after Tourapis.  The predictors tested
+             * above (median, neighbours, co-located and lowres mvs) usually land next to
+             * the final mv, so only refine the best of them.  The termination threshold
+             * depends on how well the predictors agree, and only when they disagree and
+             * the match is still poor is a wider hexagon tried. */
+            int spread = 0;
+            for( int i = 0; i < i_mvc; i++ )
+                spread = X264_MAX( spread, abs( mvc[i][0] - m->mvp[0] ) + abs( mvc[i][1] - m->mvp[1] ) );
+            int b_agree = i_mvc && spread <= 16;
+            int ucost = bcost;
+
+            DIA1_ITER( bmx, bmy );
+            if( bcost == ucost && (b_agree ? SAD_THRESH(2000) : SAD_THRESH(500)) )
+                break;
+
+            if( !b_agree && !SAD_THRESH(2000) )
+            {
+                omx = bmx; omy = bmy;
+                if( 4 > X264_MIN4( mv_x_max-omx, omx-mv_x_min, mv_y_max-omy, omy-mv_y_min ) )
+                {
+                    for( int j = 0; j < 16; j++ )
+                    {
+                        int mx = omx + hex4[j][0];
+                        int my = omy + hex4[j][1];
+                        if( CHECK_MVRANGE(mx, my) )
+                            COST_MV( mx, my );
+                    }
+                }
+                else
+                    for( int j = 0; j < 16; j += 4 )
+                        COST_MV_X4( hex4[j+0][0], hex4[j+0][1], hex4[j+1][0], hex4[j+1][1],
+                                    hex4[j+2][0], hex4[j+2][1], hex4[j+3][0], hex4[j+3][1] );
+            }
+
+            /* square refine until the best mv stops moving */
+            for( int i = i_me_range; i > 0 && CHECK_MVRANGE(bmx, bmy); i-- )
+            {
+                bcost <<= 4;
+                COST_MV_X4_DIR(  0,-1,  0,1, -1,0, 1,0, costs );
+                COPY1_IF_LT( bcost, (costs[0]<<4)+1 );
+                COPY1_IF_LT( bcost, (costs[1]<<4)+2 );
+                COPY1_IF_LT( bcost, (costs[2]<<4)+3 );
+                COPY1_IF_LT( bcost, (costs[3]<<4)+4 );
+                COST_MV_X4_DIR( -1,-1, -1,1, 1,-1, 1,1, costs );
+                COPY1_IF_LT( bcost, (costs[0]<<4)+5 );
+                COPY1_IF_LT( bcost, (costs[1]<<4)+6 );
+                COPY1_IF_LT( bcost, (costs[2]<<4)+7 );
+                COPY1_IF_LT( bcost, (costs[3]<<4)+8 );
+                int dir = bcost&15;
+                bmx += square1[dir][0];
+                bmy += square1[dir][1];
+                bcost >>= 4;
+                if( !dir )
+                    break;
+            }
+            break;
+        }
+
         case X264_ME_ESA:
         case X264_ME_TESA:
         {
@@ -814,6 +899,54 @@ void x264_me_refine_qpel_refdupe( x264_t *h, x264_me_t *m, int *p_halfpel_thresh
     refine_subpel( h, m, 0, X264_MIN( 2, subpel_iterations[h->mb.i_subpel_refine][3] ), p_halfpel_thresh, 0 );
 }
 
+/* The luma cost of a subpel candidate depends on the reference block, its weight, the
+ * partition size and the mv, but not on the mvp, so within a mb the refinements that
+ * come back to an mv (the qpel refine after the search, qpel-rd, the square after the
+ * hexagon) reuse it instead of interpolating and comparing again.  Interpolation is just
+ * an average of the hpel planes, so it is the cost, not the block, that is kept. */
+static ALWAYS_INLINE int me_cache_index( x264_me_t *m, uint32_t mv )
+{
+    uint32_t key = mv ^ (uint32_t)(uintptr_t)m->p_fref[0] ^ ((uint32_t)m->i_pixel << 28);
+    return (key * 0x9E3779B1U) >> (32 - MC_CACHE_BITS);
+}
+
+static ALWAYS_INLINE int me_cache_get( x264_t *h, x264_me_t *m, uint32_t mv, int i )
+{
+    if( h->mb.mc_cache.entry[i].i_gen == h->mb.mc_cache.i_gen &&
+        h->mb.mc_cache.entry[i].mv == mv &&
+        h->mb.mc_cache.entry[i].p_fref == m->p_fref[0] &&
+        h->mb.mc_cache.entry[i].weight == m->weight &&
+        h->mb.mc_cache.entry[i].i_pixel == m->i_pixel )
+        return h->mb.mc_cache.entry[i].cost;
+    return -1;
+}
+
+static ALWAYS_INLINE void me_cache_put( x264_t *h, x264_me_t *m, uint32_t mv, int i, int cost )
+{
+    h->mb.mc_cache.entry[i].i_gen = h->mb.mc_cache.i_gen;
+    h->mb.mc_cache.entry[i].mv = mv;
+    h->mb.mc_cache.entry[i].p_fref = m->p_fref[0];
+    h->mb.mc_cache.entry[i].weight = m->weight;
+    h->mb.mc_cache.entry[i].i_pixel = m->i_pixel;
+    h->mb.mc_cache.entry[i].cost = cost;
+}
+
+static int me_cache_luma( x264_t *h, x264_me_t *m, pixel *pix, int mx, int my )
+{
+    uint32_t mv = pack16to32_mask( mx, my );
+    int i = me_cache_index( m, mv );
+    int cost = me_cache_get( h, m, mv, i );
+    if( cost < 0 )
+    {
+        intptr_t stride = 16;
+        pixel *src = h->mc.get_ref( pix, &stride, &m->p_fref[0], m->i_stride[0], mx, my,
+                                    x264_pixel_size[m->i_pixel].w, x264_pixel_size[m->i_pixel].h, &m->weight[0] );
+        cost = h->pixf.mbcmp_unaligned[m->i_pixel]( m->p_fenc[0], FENC_STRIDE, src, stride );
+        me_cache_put( h, m, mv, i, cost );
+    }
+    return cost;
+}
+
 #define COST_MV_SAD( mx, my ) \
 { \
     intptr_t stride = 16; \
@@ -826,16 +959,13 @@ void x264_me_refine_qpel_refdupe( x264_t *h, x264_me_t *m, int *p_halfpel_thresh
 #define COST_MV_SATD( mx, my, dir ) \
 if( b_refine_qpel || (dir^1) != odir ) \
 { \
-    intptr_t stride = 16; \
-    pixel *src = h->mc.get_ref( pix, &stride, &m->p_fref[0], m->i_stride[0], mx, my, bw, bh, &m->weight[0] ); \
-    int cost = h->pixf.mbcmp_unaligned[i_pixel]( m->p_fenc[0], FENC_STRIDE, src, stride ) \
-             + p_cost_mvx[ mx ] + p_cost_mvy[ my ]; \
+    int cost = me_cache_luma( h, m, pix, mx, my ) + p_cost_mvx[ mx ] + p_cost_mvy[ my ]; \
     if( b_chroma_me && cost < bcost ) \
     { \
         if( CHROMA444 ) \
         { \
-            stride = 16; \
-            src = h->mc.get_ref( pix, &stride, &m->p_fref[4], m->i_stride[1], mx, my, bw, bh, &m->weight[1] ); \
+            intptr_t stride = 16; \
+            pixel *src = h->mc.get_ref( pix, &stride, &m->p_fref[4], m->i_stride[1], mx, my, bw, bh, &m->weight[1] ); \
             cost += h->pixf.mbcmp_unaligned[i_pixel]( m->p_fenc[1], FENC_STRIDE, src, stride ); \
             if( cost < bcost ) \
             { \
@@ -1196,9 +1326,17 @@ void x264_me_refine_bidir_rd( x264_t *h, x264_me_t *m0, x264_me_t *m1, int i_wei
 { \
     if( !avoid_mvp || !(mx == pmx && my == pmy) ) \
     { \
-        h->mc.mc_luma( pix, FDEC_STRIDE, m->p_fref, m->i_stride[0], mx, my, bw, bh, &m->weight[0] ); \
-        dst = h->pixf.mbcmp[i_pixel]( m->p_fenc[0], FENC_STRIDE, pix, FDEC_STRIDE ) \
-            + p_cost_mvx[mx] + p_cost_mvy[my]; \
+        uint32_t cache_key = pack16to32_mask( mx, my ); \
+        int cache_idx = me_cache_index( m, cache_key ); \
+        dst = me_cache_get( h, m, cache_key, cache_idx ); \
+        b_pred = dst < 0; \
+        if( b_pred ) \
+        { \
+            h->mc.mc_luma( pix, FDEC_STRIDE, m->p_fref, m->i_stride[0], mx, my, bw, bh, &m->weight[0] ); \
+            dst = h->pixf.mbcmp[i_pixel]( m->p_fenc[0], FENC_STRIDE, pix, FDEC_STRIDE ); \
+            me_cache_put( h, m, cache_key, cache_idx, dst ); \
+        } \
+        dst += p_cost_mvx[mx] + p_cost_mvy[my]; \
         COPY1_IF_LT( bsatd, dst ); \
     } \
     else \
@@ -1211,6 +1349,9 @@ void x264_me_refine_bidir_rd( x264_t *h, x264_me_t *m0, x264_me_t *m1, int i_wei
     { \
         uint64_t cost; \
         M32( cache_mv ) = pack16to32_mask(mx,my); \
+        /* the luma cost came from the cache, without the prediction */ \
+        if( !b_pred ) \
+            h->mc.mc_luma( pix, FDEC_STRIDE, m->p_fref, m->i_stride[0], mx, my, bw, bh, &m->weight[0] ); \
         if( CHROMA444 ) \
         { \
             h->mc.mc_luma( pixu, FDEC_STRIDE, &m->p_fref[4], m->i_stride[1], mx, my, bw, bh, &m->weight[1] ); \
@@ -1245,6 +1386,7 @@ void x264_me_refine_qpel_rd( x264_t *h, x264_me_t *m, int i_lambda2, int i4, int
     int bmy = m->mv[1];
     int omx, omy, pmx, pmy;
     int satd, bsatd;
+    int b_pred = 0;
     int dir = -2;
     int i8 = i4>>2;
     uint16_t amvd;
@@ -56,9 +56,23 @@ typedef struct
 } ALIGNED_64( x264_me_t );
 
 #define x264_me_search_ref x264_template(me_search_ref)
-void x264_me_search_ref( x264_t *h, x264_me_t *m, int16_t (*mvc)[2], int i_mvc, int *p_fullpel_thresh );
+void x264_me_search_ref( x264_t *h, x264_me_t *m, int16_t (*mvc)[2], int i_mvc, int *p_fullpel_thresh, int i_me_range );
 #define x264_me_search( h, m, mvc, i_mvc )\
-    x264_me_search_ref( h, m, mvc, i_mvc, NULL )
+    x264_me_search_ref( h, m, mvc, i_mvc, NULL, (h)->param.analyse.i_me_range )
+
+/* Forget the subpel candidates of the previous mb. */
+static ALWAYS_INLINE void x264_me_cache_reset( x264_t *h )
+{
+    if( !++h->mb.mc_cache.i_gen )
+    {
+        memset( h->mb.mc_cache.entry, 0, sizeof(h->mb.mc_cache.entry) );
+        h->mb.mc_cache.i_gen = 1;
+    }
+}
+
+#define HASH_ME_CANDIDATES 4
+#define x264_me_hash_predictors x264_template(me_hash_predictors)
+int x264_me_hash_predictors( x264_t *h, x264_frame_t *ref, pixel *fenc, int x, int y, int16_t (*mvc)[2], int i_mvc );
 
 #define x264_me_refine_qpel x264_template(me_refine_qpel)
 void x264_me_refine_qpel( x264_t *h, x264_me_t *m );
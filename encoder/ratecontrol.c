@@ -1633,11 +1633,11 @@ int x264_ratecontrol_mb( x264_t *h, int bits )
     if( h->param.b_sliced_threads )
     {
         float size_of_other_slices_planned = 0;
-        for( int i = 0; i < h->param.i_threads; i++ )
-            if( h != h->thread[i] )
+        for( int i = 0; i < h->i_slice_threads; i++ )
+            if( h != h->slice_thread[i] )
             {
-                size_of_other_slices += h->thread[i]->rc->frame_size_estimated;
-                size_of_other_slices_planned += h->thread[i]->rc->slice_size_planned;
+                size_of_other_slices += h->slice_thread[i]->rc->frame_size_estimated;
+                size_of_other_slices_planned += h->slice_thread[i]->rc->slice_size_planned;
             }
         float weight = rc->slice_size_planned / rc->frame_size_planned;
         size_of_other_slices = (size_of_other_slices - size_of_other_slices_planned) * weight + size_of_other_slices_planned;
@@ -2641,11 +2641,18 @@ static float rate_estimate_qscale( x264_t *h )
 static void threads_normalize_predictors( x264_t *h )
 {
     double totalsize = 0;
-    for( int i = 0; i < h->param.i_threads; i++ )
-        totalsize += h->thread[i]->rc->slice_size_planned;
+    for( int i = 0; i < h->i_slice_threads; i++ )
+        totalsize += h->slice_thread[i]->rc->slice_size_planned;
     double factor = h->rc->frame_size_planned / totalsize;
-    for( int i = 0; i < h->param.i_threads; i++ )
-        h->thread[i]->rc->slice_size_planned *= factor;
+    for( int i = 0; i < h->i_slice_threads; i++ )
+        h->slice_thread[i]->rc->slice_size_planned *= factor;
+}
+
+/* Sliced frame threads merge their slices concurrently, so each keeps its own slice predictors. */
+static int threads_slice_pred( x264_t *h, int i )
+{
+    int frame_thread = h->rc - h->thread[0]->rc;
+    return h->sh.i_type + (frame_thread * h->i_slice_threads + i + 1) * 5;
 }
 
 void x264_threads_distribute_ratecontrol( x264_t *h )
@@ -2657,16 +2664,16 @@ void x264_threads_distribute_ratecontrol( x264_t *h )
 
     /* Initialize row predictors */
     if( h->i_frame == 0 )
-        for( int i = 0; i < h->param.i_threads; i++ )
+        for( int i = 0; i < h->i_slice_threads; i++ )
         {
-            x264_t *t = h->thread[i];
+            x264_t *t = h->slice_thread[i];
             if( t != h )
                 memcpy( t->rc->row_preds, rc->row_preds, sizeof(rc->row_preds) );
         }
 
-    for( int i = 0; i < h->param.i_threads; i++ )
+    for( int i = 0; i < h->i_slice_threads; i++ )
     {
-        x264_t *t = h->thread[i];
+        x264_t *t = h->slice_thread[i];
         if( t != h )
             memcpy( t->rc, rc, offsetof(x264_ratecontrol_t, row_pred) );
         t->rc->row_pred = t->rc->row_preds[h->sh.i_type];
@@ -2676,7 +2683,7 @@ void x264_threads_distribute_ratecontrol( x264_t *h )
             int size = 0;
             for( row = t->i_threadslice_start; row < t->i_threadslice_end; row++ )
                 size += h->fdec->i_row_satd[row];
-            t->rc->slice_size_planned = predict_size( &rc->pred[h->sh.i_type + (i+1)*5], qscale, size );
+            t->rc->slice_size_planned = predict_size( &rc->pred[threads_slice_pred( h, i )], qscale, size );
         }
         else
             t->rc->slice_size_planned = 0;
@@ -2688,17 +2695,17 @@ void x264_threads_distribute_ratecontrol( x264_t *h )
         if( rc->single_frame_vbv )
         {
             /* Compensate for our max frame error threshold: give more bits (proportionally) to smaller slices. */
-            for( int i = 0; i < h->param.i_threads; i++ )
+            for( int i = 0; i < h->i_slice_threads; i++ )
             {
-                x264_t *t = h->thread[i];
+                x264_t *t = h->slice_thread[i];
                 float max_frame_error = x264_clip3f( 1.0 / (t->i_threadslice_end - t->i_threadslice_start), 0.05, 0.25 );
                 t->rc->slice_size_planned += 2 * max_frame_error * rc->frame_size_planned;
             }
             threads_normalize_predictors( h );
         }
 
-        for( int i = 0; i < h->param.i_threads; i++ )
-            h->thread[i]->rc->frame_size_estimated = h->thread[i]->rc->slice_size_planned;
+        for( int i = 0; i < h->i_slice_threads; i++ )
+            h->slice_thread[i]->rc->frame_size_estimated = h->slice_thread[i]->rc->slice_size_planned;
     }
 }
 
@@ -2707,10 +2714,10 @@ void x264_threads_merge_ratecontrol( x264_t *h )
     x264_ratecontrol_t *rc = h->rc;
     x264_emms();
 
-    for( int i = 0; i < h->param.i_threads; i++ )
+    for( int i = 0; i < h->i_slice_threads; i++ )
     {
-        x264_t *t = h->thread[i];
-        x264_ratecontrol_t *rct = h->thread[i]->rc;
+        x264_t *t = h->slice_thread[i];
+        x264_ratecontrol_t *rct = h->slice_thread[i]->rc;
         if( h->param.rc.i_vbv_buffer_size )
         {
             int size = 0;
@@ -2718,7 +2725,7 @@ void x264_threads_merge_ratecontrol( x264_t *h )
                 size += h->fdec->i_row_satd[row];
             int bits = t->stat.frame.i_mv_bits + t->stat.frame.i_tex_bits + t->stat.frame.i_misc_bits;
             int mb_count = (t->i_threadslice_end - t->i_threadslice_start) * h->mb.i_mb_width;
-            update_predictor( &rc->pred[h->sh.i_type+(i+1)*5], qp2qscale( rct->qpa_rc/mb_count ), size, bits );
+            update_predictor( &rc->pred[threads_slice_pred( h, i )], qp2qscale( rct->qpa_rc/mb_count ), size, bits );
         }
         if( !i )
             continue;
@@ -154,12 +154,97 @@ static inline int ssd_mb( x264_t *h )
     return ssd_plane(h, PIXEL_16x16, 0, 0, 0) + chroma_ssd;
 }
 
+/* Partition RD, transform RD, qpel-RD and QP-RD keep coming back to inter configurations
+ * of the mb that were already encoded (most often the winner, which QP-RD starts from),
+ * so their costs are kept for the rest of the mb, keyed on everything the encode depends
+ * on that can change within it.  A hit also restores the nnz, mvd and cbp the encode
+ * leaves behind, which later partition RD uses as context.  Intra isn't cached: its RD
+ * reuses the pixels and coefficients of the last encode.  Below subme 10 there is no
+ * QP-RD and next to nothing is evaluated twice, so the cache is only used from there. */
+static void rd_cache_reset( x264_t *h )
+{
+    if( !++h->mb.rd_cache.i_gen )
+    {
+        memset( h->mb.rd_cache.entry, 0, sizeof(h->mb.rd_cache.entry) );
+        h->mb.rd_cache.i_gen = 1;
+    }
+}
+
+static int rd_cache_index( x264_t *h, int i_lambda2, uint32_t key[RD_CACHE_KEY] )
+{
+    int i_type = h->mb.i_type;
+    int b_8x8 = i_type == P_8x8 || i_type == B_8x8;
+    /* the blocks whose ref and mv are used: one per partition, or all of them */
+    int blocks = b_8x8 || IS_SKIP( i_type ) || i_type == B_DIRECT ? 16
+               : h->mb.i_partition == D_16x16 ? 1 : 2;
+    int step = h->mb.i_partition == D_16x8 ? 8 : 4;
+
+    memset( key, 0, RD_CACHE_KEY * sizeof(uint32_t) );
+    key[0] = i_lambda2;
+    key[1] = i_type + (h->mb.i_partition << 8) + (h->mb.b_transform_8x8 << 16) + (h->mb.i_qp << 24);
+    key[2] = b_8x8 ? M32( h->mb.i_sub_partition ) : 0;
+    for( int l = 0; l <= (h->sh.i_type == SLICE_TYPE_B); l++ )
+    {
+        uint32_t *mv = key + 3 + 20*l;
+        uint32_t *ref = mv + 16;
+        for( int i = 0; i < blocks; i++ )
+        {
+            int idx = blocks == 16 ? i : i*step;
+            int i_ref = h->mb.cache.ref[l][x264_scan8[idx]];
+            mv[i] = i_ref >= 0 ? M32( h->mb.cache.mv[l][x264_scan8[idx]] ) : 0;
+            ref[i>>2] |= (uint32_t)(uint8_t)i_ref << (8*(i&3));
+        }
+    }
+
+    uint32_t hash = 0;
+    for( int i = 0; i < RD_CACHE_KEY; i++ )
+        hash = (hash + key[i]) * 0x9E3779B1U;
+    return hash >> (32 - RD_CACHE_BITS);
+}
+
+static int rd_cache_get( x264_t *h, uint32_t key[RD_CACHE_KEY], int i )
+{
+    h->stat.frame.i_rd_cache[0]++;
+    if( h->mb.rd_cache.entry[i].i_gen != h->mb.rd_cache.i_gen ||
+        memcmp( h->mb.rd_cache.entry[i].key, key, sizeof(h->mb.rd_cache.entry[i].key) ) )
+        return -1;
+    h->stat.frame.i_rd_cache[1]++;
+    h->mb.cbp[h->mb.i_mb_xy] = h->mb.rd_cache.entry[i].cbp;
+    h->mb.i_cbp_luma = h->mb.rd_cache.entry[i].i_cbp_luma;
+    h->mb.i_cbp_chroma = h->mb.rd_cache.entry[i].i_cbp_chroma;
+    memcpy( h->mb.cache.non_zero_count, h->mb.rd_cache.entry[i].non_zero_count, sizeof(h->mb.cache.non_zero_count) );
+    memcpy( h->mb.cache.mvd, h->mb.rd_cache.entry[i].mvd, sizeof(h->mb.cache.mvd) );
+    return h->mb.rd_cache.entry[i].cost;
+}
+
+static void rd_cache_put( x264_t *h, uint32_t key[RD_CACHE_KEY], int i, int cost )
+{
+    h->mb.rd_cache.entry[i].i_gen = h->mb.rd_cache.i_gen;
+    memcpy( h->mb.rd_cache.entry[i].key, key, sizeof(h->mb.rd_cache.entry[i].key) );
+    h->mb.rd_cache.entry[i].cost = cost;
+    h->mb.rd_cache.entry[i].cbp = h->mb.cbp[h->mb.i_mb_xy];
+    h->mb.rd_cache.entry[i].i_cbp_luma = h->mb.i_cbp_luma;
+    h->mb.rd_cache.entry[i].i_cbp_chroma = h->mb.i_cbp_chroma;
+    memcpy( h->mb.rd_cache.entry[i].non_zero_count, h->mb.cache.non_zero_count, sizeof(h->mb.cache.non_zero_count) );
+    memcpy( h->mb.rd_cache.entry[i].mvd, h->mb.cache.mvd, sizeof(h->mb.cache.mvd) );
+}
+
 static int rd_cost_mb( x264_t *h, int i_lambda2 )
 {
     int b_transform_bak = h->mb.b_transform_8x8;
     int i_ssd;
     int i_bits;
     int type_bak = h->mb.i_type;
+    uint32_t key[RD_CACHE_KEY];
+    int cache_idx = -1;
+
+    if( h->mb.i_subpel_refine >= 10 && !IS_INTRA( h->mb.i_type ) )
+    {
+        cache_idx = rd_cache_index( h, i_lambda2, key );
+        int cost = rd_cache_get( h, key, cache_idx );
+        if( cost >= 0 )
+            return cost;
+    }
 
     x264_macroblock_encode( h );
 
@@ -188,7 +273,10 @@ static int rd_cost_mb( x264_t *h, int i_lambda2 )
     h->mb.b_transform_8x8 = b_transform_bak;
     h->mb.i_type = type_bak;
 
-    return X264_MIN( i_ssd + i_bits, COST_MAX );
+    int cost = X264_MIN( i_ssd + i_bits, COST_MAX );
+    if( cache_idx >= 0 )
+        rd_cache_put( h, key, cache_idx, cost );
+    return cost;
 }
 
 /* partition RD functions use 8 bits more precision to avoid large rounding errors at low QPs */
@@ -189,97 +189,143 @@ static int weight_slice_header_cost( x264_t *h, x264_weight_t *w, int b_chroma )
     return lambda * numslices * ( 10 + denom_cost + 2 * (bs_size_se( w[0].i_scale ) + bs_size_se( w[0].i_offset )) );
 }
 
-static NOINLINE unsigned int weight_cost_luma( x264_t *h, x264_frame_t *fenc, pixel *src, x264_weight_t *w )
+/* The candidate weights of one scale, evaluated together so that each block is loaded once
+ * for all of them.  With lookahead threads the rows of blocks are split into bands, each
+ * adding up its own costs. */
+#define WEIGHT_CANDIDATES_MAX 5
+
+typedef struct x264_weight_cost_t
+{
+    x264_t *h;
+    x264_frame_t *fenc;
+    pixel *ref;
+    x264_weight_t *w; /* NULL for the unweighted cost */
+    int num;
+    int plane;
+    int i_start;
+    int i_end;
+    unsigned int cost[WEIGHT_CANDIDATES_MAX];
+} x264_weight_cost_t;
+
+static NOINLINE void weight_cost_luma( x264_weight_cost_t *s )
 {
-    unsigned int cost = 0;
+    x264_t *h = s->h;
+    x264_frame_t *fenc = s->fenc;
     int i_stride = fenc->i_stride_lowres;
-    int i_lines = fenc->i_lines_lowres;
     int i_width = fenc->i_width_lowres;
+    int i_mb_width = (i_width + 7) >> 3;
     pixel *fenc_plane = fenc->lowres[0];
+    pixel *src = s->ref;
     ALIGNED_ARRAY_16( pixel, buf,[8*8] );
-    int pixoff = 0;
-    int i_mb = 0;
 
-    if( w )
-    {
-        for( int y = 0; y < i_lines; y += 8, pixoff = y*i_stride )
-            for( int x = 0; x < i_width; x += 8, i_mb++, pixoff += 8)
-            {
-                w->weightfn[8>>2]( buf, 8, &src[pixoff], i_stride, w, 8 );
-                int cmp = h->pixf.mbcmp[PIXEL_8x8]( buf, 8, &fenc_plane[pixoff], i_stride );
-                cost += X264_MIN( cmp, fenc->i_intra_cost[i_mb] );
-            }
-        cost += weight_slice_header_cost( h, w, 0 );
-    }
-    else
-        for( int y = 0; y < i_lines; y += 8, pixoff = y*i_stride )
-            for( int x = 0; x < i_width; x += 8, i_mb++, pixoff += 8 )
+    for( int y = s->i_start; y < s->i_end; y++ )
+        for( int x = 0, i_mb = y*i_mb_width, pixoff = 8*y*i_stride; x < i_width; x += 8, i_mb++, pixoff += 8 )
+        {
+            if( s->w )
+                for( int i = 0; i < s->num; i++ )
+                {
+                    s->w[i].weightfn[8>>2]( buf, 8, &src[pixoff], i_stride, &s->w[i], 8 );
+                    int cmp = h->pixf.mbcmp[PIXEL_8x8]( buf, 8, &fenc_plane[pixoff], i_stride );
+                    s->cost[i] += X264_MIN( cmp, fenc->i_intra_cost[i_mb] );
+                }
+            else
             {
                 int cmp = h->pixf.mbcmp[PIXEL_8x8]( &src[pixoff], i_stride, &fenc_plane[pixoff], i_stride );
-                cost += X264_MIN( cmp, fenc->i_intra_cost[i_mb] );
+                s->cost[0] += X264_MIN( cmp, fenc->i_intra_cost[i_mb] );
             }
+        }
     x264_emms();
-    return cost;
 }
 
-static NOINLINE unsigned int weight_cost_chroma( x264_t *h, x264_frame_t *fenc, pixel *ref, x264_weight_t *w )
+static NOINLINE void weight_cost_chroma( x264_weight_cost_t *s )
 {
-    unsigned int cost = 0;
-    int i_stride = fenc->i_stride[1];
-    int i_lines = fenc->i_lines[1];
-    int i_width = fenc->i_width[1];
+    x264_t *h = s->h;
+    int i_stride = s->fenc->i_stride[1];
+    int i_width = s->fenc->i_width[1];
+    pixel *ref = s->ref;
     pixel *src = ref + (i_stride >> 1);
     ALIGNED_ARRAY_16( pixel, buf, [8*16] );
-    int pixoff = 0;
     int height = 16 >> CHROMA_V_SHIFT;
-    if( w )
-    {
-        for( int y = 0; y < i_lines; y += height, pixoff = y*i_stride )
-            for( int x = 0; x < i_width; x += 8, pixoff += 8 )
-            {
-                w->weightfn[8>>2]( buf, 8, &ref[pixoff], i_stride, w, height );
-                /* The naive and seemingly sensible algorithm is to use mbcmp as in luma.
-                 * But testing shows that for chroma the DC coefficient is by far the most
-                 * important part of the coding cost.  Thus a more useful chroma weight is
-                 * obtained by comparing each block's DC coefficient instead of the actual
-                 * pixels. */
-                cost += h->pixf.asd8( buf, 8, &src[pixoff], i_stride, height );
-            }
-        cost += weight_slice_header_cost( h, w, 1 );
-    }
-    else
-        for( int y = 0; y < i_lines; y += height, pixoff = y*i_stride )
-            for( int x = 0; x < i_width; x += 8, pixoff += 8 )
-                cost += h->pixf.asd8( &ref[pixoff], i_stride, &src[pixoff], i_stride, height );
+
+    for( int y = s->i_start; y < s->i_end; y++ )
+        for( int x = 0, pixoff = height*y*i_stride; x < i_width; x += 8, pixoff += 8 )
+        {
+            if( s->w )
+                for( int i = 0; i < s->num; i++ )
+                {
+                    s->w[i].weightfn[8>>2]( buf, 8, &ref[pixoff], i_stride, &s->w[i], height );
+                    /* The naive and seemingly sensible algorithm is to use mbcmp as in luma.
+                     * But testing shows that for chroma the DC coefficient is by far the most
+                     * important part of the coding cost.  Thus a more useful chroma weight is
+                     * obtained by comparing each block's DC coefficient instead of the actual
+                     * pixels. */
+                    s->cost[i] += h->pixf.asd8( buf, 8, &src[pixoff], i_stride, height );
+                }
+            else
+                s->cost[0] += h->pixf.asd8( &ref[pixoff], i_stride, &src[pixoff], i_stride, height );
+        }
     x264_emms();
-    return cost;
 }
 
-static NOINLINE unsigned int weight_cost_chroma444( x264_t *h, x264_frame_t *fenc, pixel *ref, x264_weight_t *w, int p )
+static NOINLINE void weight_cost_chroma444( x264_weight_cost_t *s )
 {
-    unsigned int cost = 0;
-    int i_stride = fenc->i_stride[p];
-    int i_lines = fenc->i_lines[p];
-    int i_width = fenc->i_width[p];
-    pixel *src = fenc->plane[p];
+    x264_t *h = s->h;
+    int p = s->plane;
+    int i_stride = s->fenc->i_stride[p];
+    int i_width = s->fenc->i_width[p];
+    pixel *src = s->fenc->plane[p];
+    pixel *ref = s->ref;
     ALIGNED_ARRAY_64( pixel, buf, [16*16] );
-    int pixoff = 0;
-    if( w )
+
+    for( int y = s->i_start; y < s->i_end; y++ )
+        for( int x = 0, pixoff = 16*y*i_stride; x < i_width; x += 16, pixoff += 16 )
+        {
+            if( s->w )
+                for( int i = 0; i < s->num; i++ )
+                {
+                    s->w[i].weightfn[16>>2]( buf, 16, &ref[pixoff], i_stride, &s->w[i], 16 );
+                    s->cost[i] += h->pixf.mbcmp[PIXEL_16x16]( buf, 16, &src[pixoff], i_stride );
+                }
+            else
+                s->cost[0] += h->pixf.mbcmp[PIXEL_16x16]( &ref[pixoff], i_stride, &src[pixoff], i_stride );
+        }
+    x264_emms();
+}
+
+/* Cost the candidates w[0..num-1] of a plane, or the unweighted reference if w is NULL. */
+static void weight_cost( x264_t *h, x264_frame_t *fenc, pixel *ref, x264_weight_t *w, int num, int plane,
+                         unsigned int *cost )
+{
+    void (*fn)( x264_weight_cost_t * ) = !plane ? weight_cost_luma : CHROMA444 ? weight_cost_chroma444 : weight_cost_chroma;
+    int rows = !plane ? (fenc->i_lines_lowres + 7) >> 3
+             : CHROMA444 ? (fenc->i_lines[plane] + 15) >> 4
+             : (fenc->i_lines[1] + (16 >> CHROMA_V_SHIFT) - 1) / (16 >> CHROMA_V_SHIFT);
+    x264_weight_cost_t s = { h, fenc, ref, w, w ? num : 1, plane, 0, rows };
+    int threads = X264_MIN( h->param.i_lookahead_threads, rows );
+
+    if( threads > 1 )
     {
-        for( int y = 0; y < i_lines; y += 16, pixoff = y*i_stride )
-            for( int x = 0; x < i_width; x += 16, pixoff += 16 )
-            {
-                w->weightfn[16>>2]( buf, 16, &ref[pixoff], i_stride, w, 16 );
-                cost += h->pixf.mbcmp[PIXEL_16x16]( buf, 16, &src[pixoff], i_stride );
-            }
-        cost += weight_slice_header_cost( h, w, 1 );
+        x264_weight_cost_t bands[X264_LOOKAHEAD_THREAD_MAX];
+        for( int i = 0; i < threads; i++ )
+        {
+            bands[i] = s;
+            bands[i].h = h->lookahead_thread[i];
+            bands[i].i_start = rows *  i    / threads;
+            bands[i].i_end   = rows * (i+1) / threads;
+            x264_threadpool_run( h->lookaheadpool, (void*)fn, &bands[i] );
+        }
+        for( int i = 0; i < threads; i++ )
+        {
+            x264_threadpool_wait( h->lookaheadpool, &bands[i] );
+            for( int j = 0; j < s.num; j++ )
+                s.cost[j] += bands[i].cost[j];
+        }
     }
     else
-        for( int y = 0; y < i_lines; y += 16, pixoff = y*i_stride )
-            for( int x = 0; x < i_width; x += 16, pixoff += 16 )
-                cost += h->pixf.mbcmp[PIXEL_16x16]( &ref[pixoff], i_stride, &src[pixoff], i_stride );
-    x264_emms();
-    return cost;
+        fn( &s );
+
+    for( int i = 0; i < s.num; i++ )
+        cost[i] = s.cost[i] + (w ? weight_slice_header_cost( h, &w[i], !!plane ) : 0);
 }
 
 void x264_weights_analyse( x264_t *h, x264_frame_t *fenc, x264_frame_t *ref, int b_lookahead )
@@ -360,14 +406,12 @@ void x264_weights_analyse( x264_t *h, x264_frame_t *fenc, x264_frame_t *ref, int
                 slicetype_frame_cost( h, &a, &fenc, 0, 0, 0 );
             }
             mcbuf = weight_cost_init_luma( h, fenc, ref, h->mb.p_weight_buf[0] );
-            origscore = minscore = weight_cost_luma( h, fenc, mcbuf, NULL );
         }
         else
         {
             if( CHROMA444 )
             {
                 mcbuf = weight_cost_init_chroma444( h, fenc, ref, h->mb.p_weight_buf[0], plane );
-                origscore = minscore = weight_cost_chroma444( h, fenc, mcbuf, NULL, plane );
             }
             else
             {
@@ -376,9 +420,10 @@ void x264_weights_analyse( x264_t *h, x264_frame_t *fenc, x264_frame_t *ref, int
                 if( !chroma_initted++ )
                     weight_cost_init_chroma( h, fenc, ref, dstu, dstv );
                 mcbuf = plane == 1 ? dstu : dstv;
-                origscore = minscore = weight_cost_chroma( h, fenc, mcbuf, NULL );
             }
         }
+        weight_cost( h, fenc, mcbuf, NULL, 1, plane, &origscore );
+        minscore = origscore;
 
         if( !minscore )
             continue;
@@ -410,19 +455,15 @@ void x264_weights_analyse( x264_t *h, x264_frame_t *fenc, x264_frame_t *ref, int
             }
             int start_offset = x264_clip3( cur_offset - offset_dist, -128, 127 );
             int end_offset   = x264_clip3( cur_offset + offset_dist, -128, 127 );
+            /* Cost all the offsets at once; the search below may stop before using all of them. */
+            ALIGNED_ARRAY_16( x264_weight_t, candidates,[WEIGHT_CANDIDATES_MAX] );
+            unsigned int scores[WEIGHT_CANDIDATES_MAX];
+            for( int i_off = start_offset; i_off <= end_offset; i_off++ )
+                SET_WEIGHT( candidates[i_off-start_offset], 1, cur_scale, mindenom, i_off );
+            weight_cost( h, fenc, mcbuf, candidates, end_offset - start_offset + 1, plane, scores );
             for( int i_off = start_offset; i_off <= end_offset; i_off++ )
             {
-                SET_WEIGHT( weights[plane], 1, cur_scale, mindenom, i_off );
-                unsigned int s;
-                if( plane )
-                {
-                    if( CHROMA444 )
-                        s = weight_cost_chroma444( h, fenc, mcbuf, &weights[plane], plane );
-                    else
-                        s = weight_cost_chroma( h, fenc, mcbuf, &weights[plane] );
-                }
-                else
-                    s = weight_cost_luma( h, fenc, mcbuf, &weights[plane] );
+                unsigned int s = scores[i_off-start_offset];
                 COPY4_IF_LT( minscore, s, minscale, cur_scale, minoff, i_off, found, 1 );
 
                 // Don't check any more offsets if the previous one had a lower cost than the current one
@@ -525,6 +566,7 @@ static void slicetype_mb_cost( x264_t *h, x264_mb_analysis_t *a,
     int b_frame_score_mb = (i_mb_x > 0 && i_mb_x < h->mb.i_mb_width - 1 &&
                             i_mb_y > 0 && i_mb_y < h->mb.i_mb_height - 1) ||
                             h->mb.i_mb_width <= 2 || h->mb.i_mb_height <= 2;
+    x264_me_cache_reset( h );
 
     ALIGNED_ARRAY_16( pixel, pix1,[9*FDEC_STRIDE] );
     pixel *pix2 = pix1+8;
@@ -789,6 +831,9 @@ lowres_intra_mb:
    (h->mb.i_mb_width - 2) * (h->mb.i_mb_height - 2) :\
     h->mb.i_mb_width * h->mb.i_mb_height)
 
+#define COARSE_WIDTH(frame)  (((frame)->i_width_coarse+7) >> 3)
+#define COARSE_HEIGHT(frame) (((frame)->i_lines_coarse+7) >> 3)
+
 typedef struct
 {
     x264_t *h;
@@ -804,6 +849,13 @@ typedef struct
     int *output_intra;
 } x264_slicetype_slice_t;
 
+/* The edge mbs seem to reduce the predictive quality of the
+ * whole frame's score, but are needed for a spatial distribution. */
+static ALWAYS_INLINE int lowres_do_edges( x264_t *h )
+{
+    return h->param.rc.b_mb_tree || h->param.rc.i_vbv_buffer_size || h->mb.i_mb_width <= 2 || h->mb.i_mb_height <= 2;
+}
+
 static void slicetype_slice_cost( x264_slicetype_slice_t *s )
 {
     x264_t *h = s->h;
@@ -811,9 +863,7 @@ static void slicetype_slice_cost( x264_slicetype_slice_t *s )
     /* Lowres lookahead goes backwards because the MVs are used as predictors in the main encode.
      * This considerably improves MV prediction overall. */
 
-    /* The edge mbs seem to reduce the predictive quality of the
-     * whole frame's score, but are needed for a spatial distribution. */
-    int do_edges = h->param.rc.b_mb_tree || h->param.rc.i_vbv_buffer_size || h->mb.i_mb_width <= 2 || h->mb.i_mb_height <= 2;
+    int do_edges = lowres_do_edges( h );
 
     int start_y = X264_MIN( h->i_threadslice_end - 1, h->mb.i_mb_height - 2 + do_edges );
     int end_y = X264_MAX( h->i_threadslice_start, 1 - do_edges );
@@ -826,165 +876,281 @@ static void slicetype_slice_cost( x264_slicetype_slice_t *s )
                                s->do_search, s->w, s->output_inter, s->output_intra );
 }
 
-static int slicetype_frame_cost( x264_t *h, x264_mb_analysis_t *a,
-                                 x264_frame_t **frames, int p0, int p1, int b )
+static ALWAYS_INLINE int slicetype_frame_cost_done( x264_t *h, x264_frame_t *fenc, int p0, int p1, int b )
 {
-    int i_score = 0;
-    int do_search[2];
-    const x264_weight_t *w = x264_weight_none;
-    x264_frame_t *fenc = frames[b];
-
     /* Check whether we already evaluated this frame
      * If we have tried this frame as P, then we have also tried
      * the preceding frames as B. (is this still true?) */
     /* Also check that we already calculated the row SATDs for the current frame. */
-    if( fenc->i_cost_est[b-p0][p1-b] >= 0 && (!h->param.rc.i_vbv_buffer_size || fenc->i_row_satds[b-p0][p1-b][0] != -1) )
-        i_score = fenc->i_cost_est[b-p0][p1-b];
-    else
-    {
-        int dist_scale_factor = 128;
+    return fenc->i_cost_est[b-p0][p1-b] >= 0 && (!h->param.rc.i_vbv_buffer_size || fenc->i_row_satds[b-p0][p1-b][0] != -1);
+}
 
-        /* For each list, check to see whether we have lowres motion-searched this reference frame before. */
-        do_search[0] = b != p0 && fenc->lowres_mvs[0][b-p0-1][0][0] == 0x7FFF;
-        do_search[1] = b != p1 && fenc->lowres_mvs[1][p1-b-1][0][0] == 0x7FFF;
-        if( do_search[0] )
+/* The serial part of costing a frame: pick the lists that need a motion search and analyse weights. */
+static void slicetype_frame_cost_init( x264_t *h, x264_slicetype_slice_t *s, int do_search[2] )
+{
+    int p0 = s->p0, p1 = s->p1, b = s->b;
+    x264_frame_t *fenc = s->frames[b];
+
+    s->w = x264_weight_none;
+    s->do_search = do_search;
+    s->dist_scale_factor = 128;
+
+    /* For each list, check to see whether we have lowres motion-searched this reference frame before. */
+    int search0 = b != p0 && fenc->lowres_mvs[0][b-p0-1][0][0] == 0x7FFF;
+    int search1 = b != p1 && fenc->lowres_mvs[1][p1-b-1][0][0] == 0x7FFF;
+    if( search0 )
+    {
+        if( h->param.analyse.i_weighted_pred && b == p1 )
         {
-            if( h->param.analyse.i_weighted_pred && b == p1 )
-            {
-                x264_emms();
-                x264_weights_analyse( h, fenc, frames[p0], 1 );
-                w = fenc->weight[0];
-            }
-            fenc->lowres_mvs[0][b-p0-1][0][0] = 0;
+            x264_emms();
+            x264_weights_analyse( h, fenc, s->frames[p0], 1 );
+            s->w = fenc->weight[0];
         }
-        if( do_search[1] ) fenc->lowres_mvs[1][p1-b-1][0][0] = 0;
+        fenc->lowres_mvs[0][b-p0-1][0][0] = 0;
+    }
+    if( search1 ) fenc->lowres_mvs[1][p1-b-1][0][0] = 0;
+    do_search[0] = search0;
+    do_search[1] = search1;
 
-        if( p1 != p0 )
-            dist_scale_factor = ( ((b-p0) << 8) + ((p1-p0) >> 1) ) / (p1-p0);
+    if( p1 != p0 )
+        s->dist_scale_factor = ( ((b-p0) << 8) + ((p1-p0) >> 1) ) / (p1-p0);
+}
 
-        int output_buf_size = h->mb.i_mb_height + (NUM_INTS + PAD_SIZE) * h->param.i_lookahead_threads;
-        int *output_inter[X264_LOOKAHEAD_THREAD_MAX+1];
-        int *output_intra[X264_LOOKAHEAD_THREAD_MAX+1];
-        output_inter[0] = h->scratch_buffer2;
-        output_intra[0] = output_inter[0] + output_buf_size;
+/* Sum up accumulators */
+static int slicetype_frame_cost_sum( x264_t *h, x264_frame_t *fenc, int p0, int p1, int b,
+                                     int **output_inter, int **output_intra, int num_outputs )
+{
+    if( b == p1 )
+        fenc->i_intra_mbs[b-p0] = 0;
+    if( !fenc->b_intra_calculated )
+    {
+        fenc->i_cost_est[0][0] = 0;
+        fenc->i_cost_est_aq[0][0] = 0;
+    }
+    fenc->i_cost_est[b-p0][p1-b] = 0;
+    fenc->i_cost_est_aq[b-p0][p1-b] = 0;
+    fenc->i_cost_recalc[0][b-p0][p1-b] = fenc->i_cost_recalc[1][b-p0][p1-b] = -1;
 
-#if HAVE_OPENCL
-        if( h->param.b_opencl )
+    int *row_satd_inter = fenc->i_row_satds[b-p0][p1-b];
+    int *row_satd_intra = fenc->i_row_satds[0][0];
+    for( int i = 0; i < num_outputs; i++ )
+    {
+        if( b == p1 )
+            fenc->i_intra_mbs[b-p0] += output_inter[i][INTRA_MBS];
+        if( !fenc->b_intra_calculated )
         {
-            x264_opencl_lowres_init(h, fenc, a->i_lambda );
-            if( do_search[0] )
-            {
-                x264_opencl_lowres_init( h, frames[p0], a->i_lambda );
-                x264_opencl_motionsearch( h, frames, b, p0, 0, a->i_lambda, w );
-            }
-            if( do_search[1] )
-            {
-                x264_opencl_lowres_init( h, frames[p1], a->i_lambda );
-                x264_opencl_motionsearch( h, frames, b, p1, 1, a->i_lambda, NULL );
-            }
-            if( b != p0 )
-                x264_opencl_finalize_cost( h, a->i_lambda, frames, p0, p1, b, dist_scale_factor );
-            x264_opencl_flush( h );
-
-            i_score = fenc->i_cost_est[b-p0][p1-b];
+            fenc->i_cost_est[0][0] += output_intra[i][COST_EST];
+            fenc->i_cost_est_aq[0][0] += output_intra[i][COST_EST_AQ];
         }
-        else
-#endif
+
+        fenc->i_cost_est[b-p0][p1-b] += output_inter[i][COST_EST];
+        fenc->i_cost_est_aq[b-p0][p1-b] += output_inter[i][COST_EST_AQ];
+
+        if( h->param.rc.i_vbv_buffer_size )
         {
-            if( h->param.i_lookahead_threads > 1 )
-            {
-                x264_slicetype_slice_t s[X264_LOOKAHEAD_THREAD_MAX];
+            int row_count = output_inter[i][NUM_ROWS];
+            memcpy( row_satd_inter, output_inter[i] + NUM_INTS, row_count * sizeof(int) );
+            if( !fenc->b_intra_calculated )
+                memcpy( row_satd_intra, output_intra[i] + NUM_INTS, row_count * sizeof(int) );
+            row_satd_inter += row_count;
+            row_satd_intra += row_count;
+        }
+    }
 
-                for( int i = 0; i < h->param.i_lookahead_threads; i++ )
-                {
-                    x264_t *t = h->lookahead_thread[i];
+    int i_score = fenc->i_cost_est[b-p0][p1-b];
+    if( b != p1 )
+        i_score = (uint64_t)i_score * 100 / (120 + h->param.i_bframe_bias);
+    else
+        fenc->b_intra_calculated = 1;
 
-                    /* FIXME move this somewhere else */
-                    t->mb.i_me_method = h->mb.i_me_method;
-                    t->mb.i_subpel_refine = h->mb.i_subpel_refine;
-                    t->mb.b_chroma_me = h->mb.b_chroma_me;
+    fenc->i_cost_est[b-p0][p1-b] = i_score;
+    x264_emms();
+    return i_score;
+}
 
-                    s[i] = (x264_slicetype_slice_t){ t, a, frames, p0, p1, b, dist_scale_factor, do_search, w,
-                        output_inter[i], output_intra[i] };
+/* Cost a frame set up by slicetype_frame_cost_init, split into slices across the lookahead threads. */
+static int slicetype_frame_cost_run( x264_t *h, x264_slicetype_slice_t *s0 )
+{
+    int output_buf_size = h->mb.i_mb_height + (NUM_INTS + PAD_SIZE) * h->param.i_lookahead_threads;
+    int *output_inter[X264_LOOKAHEAD_THREAD_MAX+1];
+    int *output_intra[X264_LOOKAHEAD_THREAD_MAX+1];
+    output_inter[0] = h->scratch_buffer2;
+    output_intra[0] = output_inter[0] + output_buf_size;
 
-                    t->i_threadslice_start = ((h->mb.i_mb_height *  i    + h->param.i_lookahead_threads/2) / h->param.i_lookahead_threads);
-                    t->i_threadslice_end   = ((h->mb.i_mb_height * (i+1) + h->param.i_lookahead_threads/2) / h->param.i_lookahead_threads);
+    if( h->param.i_lookahead_threads > 1 )
+    {
+        x264_slicetype_slice_t s[X264_LOOKAHEAD_THREAD_MAX];
 
-                    int thread_height = t->i_threadslice_end - t->i_threadslice_start;
-                    int thread_output_size = thread_height + NUM_INTS;
-                    memset( output_inter[i], 0, thread_output_size * sizeof(int) );
-                    memset( output_intra[i], 0, thread_output_size * sizeof(int) );
-                    output_inter[i][NUM_ROWS] = output_intra[i][NUM_ROWS] = thread_height;
+        for( int i = 0; i < h->param.i_lookahead_threads; i++ )
+        {
+            x264_t *t = h->lookahead_thread[i];
 
-                    output_inter[i+1] = output_inter[i] + thread_output_size + PAD_SIZE;
-                    output_intra[i+1] = output_intra[i] + thread_output_size + PAD_SIZE;
+            /* FIXME move this somewhere else */
+            t->mb.i_me_method = h->mb.i_me_method;
+            t->mb.i_subpel_refine = h->mb.i_subpel_refine;
+            t->mb.b_chroma_me = h->mb.b_chroma_me;
 
-                    x264_threadpool_run( h->lookaheadpool, (void*)slicetype_slice_cost, &s[i] );
-                }
-                for( int i = 0; i < h->param.i_lookahead_threads; i++ )
-                    x264_threadpool_wait( h->lookaheadpool, &s[i] );
-            }
-            else
-            {
-                h->i_threadslice_start = 0;
-                h->i_threadslice_end = h->mb.i_mb_height;
-                memset( output_inter[0], 0, (output_buf_size - PAD_SIZE) * sizeof(int) );
-                memset( output_intra[0], 0, (output_buf_size - PAD_SIZE) * sizeof(int) );
-                output_inter[0][NUM_ROWS] = output_intra[0][NUM_ROWS] = h->mb.i_mb_height;
-                x264_slicetype_slice_t s = (x264_slicetype_slice_t){ h, a, frames, p0, p1, b, dist_scale_factor, do_search, w,
-                    output_inter[0], output_intra[0] };
-                slicetype_slice_cost( &s );
-            }
+            s[i] = *s0;
+            s[i].h = t;
+            s[i].output_inter = output_inter[i];
+            s[i].output_intra = output_intra[i];
 
-            /* Sum up accumulators */
-            if( b == p1 )
-                fenc->i_intra_mbs[b-p0] = 0;
-            if( !fenc->b_intra_calculated )
-            {
-                fenc->i_cost_est[0][0] = 0;
-                fenc->i_cost_est_aq[0][0] = 0;
-            }
-            fenc->i_cost_est[b-p0][p1-b] = 0;
-            fenc->i_cost_est_aq[b-p0][p1-b] = 0;
+            t->i_threadslice_start = ((h->mb.i_mb_height *  i    + h->param.i_lookahead_threads/2) / h->param.i_lookahead_threads);
+            t->i_threadslice_end   = ((h->mb.i_mb_height * (i+1) + h->param.i_lookahead_threads/2) / h->param.i_lookahead_threads);
 
-            int *row_satd_inter = fenc->i_row_satds[b-p0][p1-b];
-            int *row_satd_intra = fenc->i_row_satds[0][0];
-            for( int i = 0; i < h->param.i_lookahead_threads; i++ )
-            {
-                if( b == p1 )
-                    fenc->i_intra_mbs[b-p0] += output_inter[i][INTRA_MBS];
-                if( !fenc->b_intra_calculated )
-                {
-                    fenc->i_cost_est[0][0] += output_intra[i][COST_EST];
-                    fenc->i_cost_est_aq[0][0] += output_intra[i][COST_EST_AQ];
-                }
+            int thread_height = t->i_threadslice_end - t->i_threadslice_start;
+            int thread_output_size = thread_height + NUM_INTS;
+            memset( output_inter[i], 0, thread_output_size * sizeof(int) );
+            memset( output_intra[i], 0, thread_output_size * sizeof(int) );
+            output_inter[i][NUM_ROWS] = output_intra[i][NUM_ROWS] = thread_height;
 
-                fenc->i_cost_est[b-p0][p1-b] += output_inter[i][COST_EST];
-                fenc->i_cost_est_aq[b-p0][p1-b] += output_inter[i][COST_EST_AQ];
+            output_inter[i+1] = output_inter[i] + thread_output_size + PAD_SIZE;
+            output_intra[i+1] = output_intra[i] + thread_output_size + PAD_SIZE;
 
-                if( h->param.rc.i_vbv_buffer_size )
-                {
-                    int row_count = output_inter[i][NUM_ROWS];
-                    memcpy( row_satd_inter, output_inter[i] + NUM_INTS, row_count * sizeof(int) );
-                    if( !fenc->b_intra_calculated )
-                        memcpy( row_satd_intra, output_intra[i] + NUM_INTS, row_count * sizeof(int) );
-                    row_satd_inter += row_count;
-                    row_satd_intra += row_count;
-                }
-            }
+            x264_threadpool_run( h->lookaheadpool, (void*)slicetype_slice_cost, &s[i] );
+        }
+        for( int i = 0; i < h->param.i_lookahead_threads; i++ )
+            x264_threadpool_wait( h->lookaheadpool, &s[i] );
+    }
+    else
+    {
+        h->i_threadslice_start = 0;
+        h->i_threadslice_end = h->mb.i_mb_height;
+        memset( output_inter[0], 0, (output_buf_size - PAD_SIZE) * sizeof(int) );
+        memset( output_intra[0], 0, (output_buf_size - PAD_SIZE) * sizeof(int) );
+        output_inter[0][NUM_ROWS] = output_intra[0][NUM_ROWS] = h->mb.i_mb_height;
+        x264_slicetype_slice_t s = *s0;
+        s.h = h;
+        s.output_inter = output_inter[0];
+        s.output_intra = output_intra[0];
+        slicetype_slice_cost( &s );
+    }
 
-            i_score = fenc->i_cost_est[b-p0][p1-b];
-            if( b != p1 )
-                i_score = (uint64_t)i_score * 100 / (120 + h->param.i_bframe_bias);
-            else
-                fenc->b_intra_calculated = 1;
+    return slicetype_frame_cost_sum( h, s0->frames[s0->b], s0->p0, s0->p1, s0->b,
+                                     output_inter, output_intra, h->param.i_lookahead_threads );
+}
 
-            fenc->i_cost_est[b-p0][p1-b] = i_score;
-            x264_emms();
+static int slicetype_frame_cost( x264_t *h, x264_mb_analysis_t *a,
+                                 x264_frame_t **frames, int p0, int p1, int b )
+{
+    x264_frame_t *fenc = frames[b];
+    if( slicetype_frame_cost_done( h, fenc, p0, p1, b ) )
+        return fenc->i_cost_est[b-p0][p1-b];
+
+    int do_search[2];
+    x264_slicetype_slice_t s = { h, a, frames, p0, p1, b };
+    slicetype_frame_cost_init( h, &s, do_search );
+
+#if HAVE_OPENCL
+    if( h->param.b_opencl )
+    {
+        x264_opencl_lowres_init(h, fenc, a->i_lambda );
+        if( do_search[0] )
+        {
+            x264_opencl_lowres_init( h, frames[p0], a->i_lambda );
+            x264_opencl_motionsearch( h, frames, b, p0, 0, a->i_lambda, s.w );
+        }
+        if( do_search[1] )
+        {
+            x264_opencl_lowres_init( h, frames[p1], a->i_lambda );
+            x264_opencl_motionsearch( h, frames, b, p1, 1, a->i_lambda, NULL );
         }
+        if( b != p0 )
+            x264_opencl_finalize_cost( h, a->i_lambda, frames, p0, p1, b, s.dist_scale_factor );
+        x264_opencl_flush( h );
+
+        return fenc->i_cost_est[b-p0][p1-b];
     }
+#endif
 
-    return i_score;
+    return slicetype_frame_cost_run( h, &s );
+}
+
+/* A frame costed whole by one lookahead thread, as part of a batch. */
+static void slicetype_frame_cost_job( x264_slicetype_slice_t *s )
+{
+    x264_t *h = s->h;
+    int output_size = h->mb.i_mb_height + NUM_INTS;
+    h->i_threadslice_start = 0;
+    h->i_threadslice_end = h->mb.i_mb_height;
+    memset( s->output_inter, 0, output_size * sizeof(int) );
+    memset( s->output_intra, 0, output_size * sizeof(int) );
+    s->output_inter[NUM_ROWS] = s->output_intra[NUM_ROWS] = h->mb.i_mb_height;
+    slicetype_slice_cost( s );
+    slicetype_frame_cost_sum( h, s->frames[s->b], s->p0, s->p1, s->b, &s->output_inter, &s->output_intra, 1 );
+}
+
+static void slicetype_frame_cost_add( int (*list)[3], int *count, int p0, int p1, int b )
+{
+    list[*count][0] = p0;
+    list[*count][1] = p1;
+    list[*count][2] = b;
+    (*count)++;
+}
+
+/* Do the frames of a batch use each other's results? A B-frame reuses the motion
+ * vectors of its future reference as predictors. */
+static int slicetype_frame_cost_depends( const int *x, const int *y )
+{
+    return x[2] == y[2] || (x[2] < x[1] && x[1] == y[2]) || (y[2] < y[1] && y[1] == x[2]);
+}
+
+/* Lookahead threads normally split each frame cost into slices, which leaves most of them
+ * waiting on the slowest slice for every small frame. When the caller knows up front which
+ * frame costs it is going to need, cost them here instead, giving each thread a whole frame.
+ * The list is in the order the caller will ask for the costs; it is run in waves of frames
+ * that don't depend on each other, so the results match costing them one at a time. */
+static void slicetype_frame_cost_batch( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **frames,
+                                        int (*list)[3], int count )
+{
+    int threads = h->param.i_lookahead_threads;
+    x264_slicetype_slice_t s[X264_LOOKAHEAD_THREAD_MAX];
+    int do_search[X264_LOOKAHEAD_THREAD_MAX][2];
+    int wave[X264_LOOKAHEAD_THREAD_MAX];
+    int output_size = h->mb.i_mb_height + NUM_INTS + PAD_SIZE;
+    int n = 0;
+
+    if( threads <= 1 || h->param.b_opencl )
+        return;
+
+    for( int i = 0; i <= count; i++ )
+    {
+        int flush = i == count || n == threads;
+        if( i < count )
+        {
+            int p0 = list[i][0], p1 = list[i][1], b = list[i][2];
+            if( slicetype_frame_cost_done( h, frames[b], p0, p1, b ) )
+                continue;
+            for( int j = 0; j < n; j++ )
+                flush |= slicetype_frame_cost_depends( list[wave[j]], list[i] );
+            /* Weight analysis may cost the frame as intra, using the lookahead threads. */
+            flush |= h->param.analyse.i_weighted_pred && b == p1 && b != p0 && frames[b]->lowres_mvs[0][b-p0-1][0][0] == 0x7FFF;
+        }
+
+        if( flush && n == 1 )
+            slicetype_frame_cost_run( h, &s[0] );
+        else if( flush && n )
+        {
+            for( int j = 0; j < n; j++ )
+                x264_threadpool_run( h->lookaheadpool, (void*)slicetype_frame_cost_job, &s[j] );
+            for( int j = 0; j < n; j++ )
+                x264_threadpool_wait( h->lookaheadpool, &s[j] );
+        }
+        if( flush )
+            n = 0;
+        if( i == count )
+            break;
+
+        x264_t *t = h->lookahead_thread[n];
+        t->mb.i_me_method = h->mb.i_me_method;
+        t->mb.i_subpel_refine = h->mb.i_subpel_refine;
+        t->mb.b_chroma_me = h->mb.b_chroma_me;
+        s[n] = (x264_slicetype_slice_t){ t, a, frames, list[i][0], list[i][1], list[i][2] };
+        slicetype_frame_cost_init( h, &s[n], do_search[n] );
+        s[n].output_inter = (int*)h->scratch_buffer2 + 2 * n * output_size;
+        s[n].output_intra = s[n].output_inter + output_size;
+        wave[n++] = i;
+    }
 }
 
 /* If MB-tree changes the quantizers, we need to recalculate the frame cost without
@@ -1019,17 +1185,65 @@ static int slicetype_frame_cost_recalculate( x264_t *h, x264_frame_t **frames, i
 /* Trade off precision in mbtree for increased range */
 #define MBTREE_PRECISION 0.5f
 
-static void macroblock_tree_finish( x264_t *h, x264_frame_t *frame, float average_duration, int ref0_distance )
+/* A band of rows of one frame, for running the mbtree passes on the lookahead threads. */
+typedef struct x264_mbtree_rows_t
 {
-    int fps_factor = round( CLIP_DURATION(average_duration) / CLIP_DURATION(frame->f_duration) * 256 / MBTREE_PRECISION );
+    x264_t *h;
+    x264_frame_t **frames;
+    int p0;
+    int p1;
+    int b;
+    int referenced;
+    int bipred_weights[2];
+    float fps_factor;
+    float average_duration;
+    int ref0_distance;
+    uint16_t *propagate_in;
+    int i_start;
+    int i_end;
+    /* Where this band's propagate costs go, the rows of the references it reached, and all the bands. */
+    uint16_t *ref_costs[2];
+    int i_reach_start;
+    int i_reach_end;
+    struct x264_mbtree_rows_t *bands;
+} x264_mbtree_rows_t;
+
+static void macroblock_tree_rows_init( x264_t *h, x264_mbtree_rows_t *s0, x264_mbtree_rows_t *s )
+{
+    int threads = h->param.i_lookahead_threads;
+    for( int i = 0; i < threads; i++ )
+    {
+        s[i] = *s0;
+        s[i].h = h->lookahead_thread[i];
+        /* The lookahead threads are copied before the macroblock cache is set up. */
+        s[i].h->mb.i_mb_stride = h->mb.i_mb_stride;
+        s[i].i_start = (h->mb.i_mb_height *  i    + threads/2) / threads;
+        s[i].i_end   = (h->mb.i_mb_height * (i+1) + threads/2) / threads;
+        s[i].bands = s;
+    }
+}
+
+static void macroblock_tree_rows_run( x264_t *h, x264_mbtree_rows_t *s, void (*fn)( x264_mbtree_rows_t * ) )
+{
+    for( int i = 0; i < h->param.i_lookahead_threads; i++ )
+        x264_threadpool_run( h->lookaheadpool, (void*)fn, &s[i] );
+    for( int i = 0; i < h->param.i_lookahead_threads; i++ )
+        x264_threadpool_wait( h->lookaheadpool, &s[i] );
+}
+
+static void macroblock_tree_finish_rows( x264_mbtree_rows_t *s )
+{
+    x264_t *h = s->h;
+    x264_frame_t *frame = s->frames[s->b];
+    int fps_factor = round( CLIP_DURATION(s->average_duration) / CLIP_DURATION(frame->f_duration) * 256 / MBTREE_PRECISION );
     float weightdelta = 0.0;
-    if( ref0_distance && frame->f_weighted_cost_delta[ref0_distance-1] > 0 )
-        weightdelta = (1.0 - frame->f_weighted_cost_delta[ref0_distance-1]) * 10.0f * h->param.rc.f_fade_compensate;
+    if( s->ref0_distance && frame->f_weighted_cost_delta[s->ref0_distance-1] > 0 )
+        weightdelta = (1.0 - frame->f_weighted_cost_delta[s->ref0_distance-1]) * 10.0f * h->param.rc.f_fade_compensate;
 
     /* Allow the strength to be adjusted via qcompress, since the two
      * concepts are very similar. */
     float strength = 5.0f * (1.0f - h->param.rc.f_qcompress);
-    for( int mb_index = 0; mb_index < h->mb.i_mb_count; mb_index++ )
+    for( int mb_index = s->i_start * h->mb.i_mb_width; mb_index < s->i_end * h->mb.i_mb_width; mb_index++ )
     {
         int intra_cost = (frame->i_intra_cost[mb_index] * frame->i_inv_qscale_factor[mb_index] + 128) >> 8;
         if( intra_cost )
@@ -1039,46 +1253,200 @@ static void macroblock_tree_finish( x264_t *h, x264_frame_t *frame, float averag
             frame->f_qp_offset[mb_index] = frame->f_qp_offset_aq[mb_index] - strength * log2_ratio;
         }
     }
+    x264_emms();
+}
+
+static void macroblock_tree_finish( x264_t *h, x264_frame_t **frames, float average_duration, int b, int ref0_distance )
+{
+    x264_mbtree_rows_t s = { h, frames, 0, 0, b };
+    s.average_duration = average_duration;
+    s.ref0_distance = ref0_distance;
+    s.i_end = h->mb.i_mb_height;
+    memset( frames[b]->i_cost_recalc[0], -1, sizeof(frames[b]->i_cost_recalc[0]) );
+
+    if( h->param.i_lookahead_threads > 1 )
+    {
+        x264_mbtree_rows_t bands[X264_LOOKAHEAD_THREAD_MAX];
+        macroblock_tree_rows_init( h, &s, bands );
+        macroblock_tree_rows_run( h, bands, macroblock_tree_finish_rows );
+    }
+    else
+        macroblock_tree_finish_rows( &s );
+}
+
+static void macroblock_tree_propagate_rows( x264_mbtree_rows_t *s )
+{
+    x264_t *h = s->h;
+    x264_frame_t *fenc = s->frames[s->b];
+    int p0 = s->p0, p1 = s->p1, b = s->b;
+    int16_t (*mvs[2])[2] = { fenc->lowres_mvs[0][b-p0-1], fenc->lowres_mvs[1][p1-b-1] };
+    int16_t *buf = h->scratch_buffer;
+    uint16_t *lowres_costs = fenc->lowres_costs[b-p0][p1-b];
+
+    for( int mb_y = s->i_start; mb_y < s->i_end; mb_y++ )
+    {
+        int mb_index = mb_y*h->mb.i_mb_stride;
+        /* For non-reffed frames the source costs are always zero, so just re-use the first row. */
+        uint16_t *propagate_cost = s->propagate_in + (s->referenced ? mb_y*h->mb.i_mb_width : 0);
+        h->mc.mbtree_propagate_cost( buf, propagate_cost,
+            fenc->i_intra_cost+mb_index, lowres_costs+mb_index,
+            fenc->i_inv_qscale_factor+mb_index, &s->fps_factor, h->mb.i_mb_width );
+
+        h->mc.mbtree_propagate_list( h, s->ref_costs[0], &mvs[0][mb_index], buf, &lowres_costs[mb_index],
+                                     s->bipred_weights[0], mb_y, h->mb.i_mb_width, 0 );
+        if( b != p1 )
+        {
+            h->mc.mbtree_propagate_list( h, s->ref_costs[1], &mvs[1][mb_index], buf, &lowres_costs[mb_index],
+                                         s->bipred_weights[1], mb_y, h->mb.i_mb_width, 1 );
+        }
+    }
 }
 
-static void macroblock_tree_propagate( x264_t *h, x264_frame_t **frames, float average_duration, int p0, int p1, int b, int referenced )
+/* Every band but the first propagates into zeroed buffers of its own, covering only
+ * the rows of the references its motion vectors can reach. */
+static void macroblock_tree_propagate_band( x264_mbtree_rows_t *s )
+{
+    x264_t *h = s->h;
+    x264_frame_t *fenc = s->frames[s->b];
+    int lists = 1 + (s->b != s->p1);
+    int min_y = 0, max_y = 0;
+
+    if( s != s->bands )
+    {
+        for( int l = 0; l < lists; l++ )
+        {
+            int16_t (*mvs)[2] = l ? fenc->lowres_mvs[1][s->p1-s->b-1] : fenc->lowres_mvs[0][s->b-s->p0-1];
+            for( int i = s->i_start * h->mb.i_mb_width; i < s->i_end * h->mb.i_mb_width; i++ )
+            {
+                min_y = X264_MIN( min_y, mvs[i][1] );
+                max_y = X264_MAX( max_y, mvs[i][1] );
+            }
+        }
+        s->i_reach_start = x264_clip3( s->i_start + (min_y >> 5), 0, h->mb.i_mb_height );
+        s->i_reach_end = x264_clip3( s->i_end + (max_y >> 5) + 1, 0, h->mb.i_mb_height );
+        int size = (s->i_reach_end - s->i_reach_start) * h->mb.i_mb_width * sizeof(uint16_t);
+        for( int l = 0; l < lists; l++ )
+        {
+            s->ref_costs[l] = (uint16_t*)((int16_t*)h->scratch_buffer + ((h->mb.i_mb_width+15)&~15)) + l * h->mb.i_mb_count;
+            memset( s->ref_costs[l] + s->i_reach_start * h->mb.i_mb_width, 0, size );
+        }
+    }
+    macroblock_tree_propagate_rows( s );
+}
+
+/* Add the other bands' propagate costs for these rows of the references, always in the same order. */
+static void macroblock_tree_merge_band( x264_mbtree_rows_t *s )
+{
+    x264_t *h = s->h;
+    uint16_t **ref_costs = s->bands[0].ref_costs;
+    int lists = 1 + (s->b != s->p1);
+
+    for( int i = 1; i < h->param.i_lookahead_threads; i++ )
+    {
+        x264_mbtree_rows_t *band = &s->bands[i];
+        int start = X264_MAX( s->i_start, band->i_reach_start ) * h->mb.i_mb_width;
+        int end = X264_MIN( s->i_end, band->i_reach_end ) * h->mb.i_mb_width;
+        for( int l = 0; l < lists; l++ )
+            for( int j = start; j < end; j++ )
+                MC_CLIP_ADD( ref_costs[l][j], band->ref_costs[l][j] );
+    }
+}
+
+/* With b_delta, only pass on the growth of the frame's propagate cost since it was last
+ * propagated, which is left in i_propagate_sent; its own intra cost was passed on then. */
+static void macroblock_tree_propagate( x264_t *h, x264_frame_t **frames, float average_duration, int p0, int p1, int b, int referenced, int b_delta )
 {
-    uint16_t *ref_costs[2] = {frames[p0]->i_propagate_cost,frames[p1]->i_propagate_cost};
     int dist_scale_factor = ( ((b-p0) << 8) + ((p1-p0) >> 1) ) / (p1-p0);
     int i_bipred_weight = h->param.analyse.b_weighted_bipred ? 64 - (dist_scale_factor>>2) : 32;
-    int16_t (*mvs[2])[2] = { frames[b]->lowres_mvs[0][b-p0-1], frames[b]->lowres_mvs[1][p1-b-1] };
-    int bipred_weights[2] = {i_bipred_weight, 64 - i_bipred_weight};
-    int16_t *buf = h->scratch_buffer;
-    uint16_t *propagate_cost = frames[b]->i_propagate_cost;
-    uint16_t *lowres_costs = frames[b]->lowres_costs[b-p0][p1-b];
 
     x264_emms();
-    float fps_factor = CLIP_DURATION(frames[b]->f_duration) / (CLIP_DURATION(average_duration) * 256.0f) * MBTREE_PRECISION;
+    x264_mbtree_rows_t s = { h, frames, p0, p1, b, referenced, { i_bipred_weight, 64 - i_bipred_weight } };
+    s.fps_factor = b_delta ? 0 : CLIP_DURATION(frames[b]->f_duration) / (CLIP_DURATION(average_duration) * 256.0f) * MBTREE_PRECISION;
+    s.propagate_in = b_delta ? frames[b]->i_propagate_sent : frames[b]->i_propagate_cost;
+    s.i_end = h->mb.i_mb_height;
+    s.ref_costs[0] = frames[p0]->i_propagate_cost;
+    s.ref_costs[1] = frames[p1]->i_propagate_cost;
 
-    /* For non-reffed frames the source costs are always zero, so just memset one row and re-use it. */
     if( !referenced )
         memset( frames[b]->i_propagate_cost, 0, h->mb.i_mb_width * sizeof(uint16_t) );
 
-    for( h->mb.i_mb_y = 0; h->mb.i_mb_y < h->mb.i_mb_height; h->mb.i_mb_y++ )
+    /* Propagation scatters into the references, so with lookahead threads each band of rows
+     * gets its own accumulators, which are then added up band by band. */
+    if( h->param.i_lookahead_threads > 1 )
     {
-        int mb_index = h->mb.i_mb_y*h->mb.i_mb_stride;
-        h->mc.mbtree_propagate_cost( buf, propagate_cost,
-            frames[b]->i_intra_cost+mb_index, lowres_costs+mb_index,
-            frames[b]->i_inv_qscale_factor+mb_index, &fps_factor, h->mb.i_mb_width );
-        if( referenced )
-            propagate_cost += h->mb.i_mb_width;
+        x264_mbtree_rows_t bands[X264_LOOKAHEAD_THREAD_MAX];
+        macroblock_tree_rows_init( h, &s, bands );
+        macroblock_tree_rows_run( h, bands, macroblock_tree_propagate_band );
+        macroblock_tree_rows_run( h, bands, macroblock_tree_merge_band );
+    }
+    else
+        macroblock_tree_propagate_rows( &s );
 
-        h->mc.mbtree_propagate_list( h, ref_costs[0], &mvs[0][mb_index], buf, &lowres_costs[mb_index],
-                                     bipred_weights[0], h->mb.i_mb_y, h->mb.i_mb_width, 0 );
-        if( b != p1 )
+    if( h->param.rc.i_vbv_buffer_size && h->param.rc.i_lookahead && referenced )
+        macroblock_tree_finish( h, frames, average_duration, b, b == p1 ? b - p0 : 0 );
+}
+
+/* Incremental mbtree keeps the propagate costs of the previous lookahead windows.  A frame new
+ * to the window propagates in full; after that, a referenced frame only passes on what it has
+ * gained since, and only while the sweep (frames sweep_start+1 to sweep_end) is over it. */
+static void macroblock_tree_send( x264_t *h, x264_frame_t **frames, float average_duration, int p0, int p1, int b,
+                                  int referenced, int sweep_start, int sweep_end )
+{
+    x264_frame_t *fenc = frames[b];
+    if( !h->param.rc.i_incremental_lookahead )
+    {
+        macroblock_tree_propagate( h, frames, average_duration, p0, p1, b, referenced, 0 );
+        return;
+    }
+
+    if( fenc->i_mbtree_ref[0] < 0 )
+    {
+        macroblock_tree_propagate( h, frames, average_duration, p0, p1, b, referenced, 0 );
+        fenc->i_mbtree_ref[0] = frames[p0]->i_frame;
+        fenc->i_mbtree_ref[1] = frames[p1]->i_frame;
+    }
+    else if( referenced && b > sweep_start && b <= sweep_end )
+    {
+        /* Propagate costs only ever grow here, so the difference is never negative. */
+        int changed = 0;
+        for( int i = 0; i < h->mb.i_mb_count; i++ )
         {
-            h->mc.mbtree_propagate_list( h, ref_costs[1], &mvs[1][mb_index], buf, &lowres_costs[mb_index],
-                                         bipred_weights[1], h->mb.i_mb_y, h->mb.i_mb_width, 1 );
+            fenc->i_propagate_sent[i] = fenc->i_propagate_cost[i] - fenc->i_propagate_sent[i];
+            changed |= fenc->i_propagate_sent[i];
         }
+        if( changed )
+            macroblock_tree_propagate( h, frames, average_duration, p0, p1, b, referenced, 1 );
     }
+    else
+        return;
 
-    if( h->param.rc.i_vbv_buffer_size && h->param.rc.i_lookahead && referenced )
-        macroblock_tree_finish( h, frames[b], average_duration, b == p1 ? b - p0 : 0 );
+    if( referenced )
+        memcpy( fenc->i_propagate_sent, fenc->i_propagate_cost, h->mb.i_mb_count * sizeof(uint16_t) );
+}
+
+/* Incremental mbtree: if a frame already propagated into references other than the ones planned
+ * now, or sits past the end of the walk, the carried costs are wrong; start the window over. */
+static void macroblock_tree_check_structure( x264_t *h, x264_frame_t **frames, int num_frames, int idx,
+                                             int last_nonb, int (*costs)[3], int num_costs )
+{
+    int b_reset = 0;
+    for( int i = 0; i < num_costs && !b_reset; i++ )
+    {
+        x264_frame_t *fenc = frames[costs[i][2]];
+        b_reset = fenc->i_mbtree_ref[0] >= 0 && (fenc->i_mbtree_ref[0] != frames[costs[i][0]]->i_frame ||
+                                                 fenc->i_mbtree_ref[1] != frames[costs[i][1]]->i_frame);
+    }
+    for( int i = last_nonb + 1; i <= num_frames && !b_reset; i++ )
+        b_reset = frames[i]->i_mbtree_ref[0] >= 0;
+    if( !b_reset )
+        return;
+
+    for( int i = idx; i <= num_frames; i++ )
+    {
+        memset( frames[i]->i_propagate_cost, 0, h->mb.i_mb_count * sizeof(uint16_t) );
+        frames[i]->i_mbtree_ref[0] = frames[i]->i_mbtree_ref[1] = -1;
+    }
+    h->lookahead->i_mbtree_sweep = -1;
 }
 
 static void macroblock_tree( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **frames, int num_frames, int b_intra )
@@ -1120,7 +1488,46 @@ static void macroblock_tree( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **fr
     {
         if( last_nonb < idx )
             return;
-        memset( frames[last_nonb]->i_propagate_cost, 0, h->mb.i_mb_count * sizeof(uint16_t) );
+        if( !h->param.rc.i_incremental_lookahead )
+            memset( frames[last_nonb]->i_propagate_cost, 0, h->mb.i_mb_count * sizeof(uint16_t) );
+    }
+
+    /* Walk the minigops as below, collecting the frame costs needed so they can be batched. */
+    int costs[X264_LOOKAHEAD_MAX+2][3];
+    int num_costs = 0;
+    for( int j = i, cur = 0, last = last_nonb; j-- > idx; last = cur )
+    {
+        for( cur = j; IS_X264_TYPE_B( frames[cur]->i_type ) && cur > 0; )
+            cur--;
+        if( cur < idx )
+            break;
+        slicetype_frame_cost_add( costs, &num_costs, cur, last, last );
+        int middle = h->param.i_bframe_pyramid && last - cur - 1 > 1 ? (last - cur)/2 + cur : -1;
+        if( middle >= 0 )
+            slicetype_frame_cost_add( costs, &num_costs, cur, last, middle );
+        for( ; j > cur; j-- )
+            if( j != middle )
+            {
+                int p0 = middle >= 0 && j > middle ? middle : cur;
+                int p1 = middle >= 0 && j < middle ? middle : last;
+                slicetype_frame_cost_add( costs, &num_costs, p0, p1, j );
+            }
+    }
+    slicetype_frame_cost_batch( h, a, frames, costs, num_costs );
+
+    /* Each call the sweep passes changes back through the next i_incremental_lookahead frames,
+     * restarting from the end of the window once it has reached the front. */
+    int incremental = h->param.rc.i_incremental_lookahead;
+    int sweep_start = 0, sweep_end = num_frames;
+    if( incremental )
+    {
+        macroblock_tree_check_structure( h, frames, num_frames, idx, last_nonb, costs, num_costs );
+        sweep_end = last_nonb;
+        for( int j = idx; j <= last_nonb; j++ )
+            if( frames[j]->i_frame == h->lookahead->i_mbtree_sweep )
+                sweep_end = j;
+        sweep_start = sweep_end - incremental;
+        h->lookahead->i_mbtree_sweep = sweep_start > idx ? frames[sweep_start]->i_frame : -1;
     }
 
     while( i-- > idx )
@@ -1131,13 +1538,15 @@ static void macroblock_tree( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **fr
         if( cur_nonb < idx )
             break;
         slicetype_frame_cost( h, a, frames, cur_nonb, last_nonb, last_nonb );
-        memset( frames[cur_nonb]->i_propagate_cost, 0, h->mb.i_mb_count * sizeof(uint16_t) );
+        if( !incremental )
+            memset( frames[cur_nonb]->i_propagate_cost, 0, h->mb.i_mb_count * sizeof(uint16_t) );
         bframes = last_nonb - cur_nonb - 1;
         if( h->param.i_bframe_pyramid && bframes > 1 )
         {
             int middle = (bframes + 1)/2 + cur_nonb;
             slicetype_frame_cost( h, a, frames, cur_nonb, last_nonb, middle );
-            memset( frames[middle]->i_propagate_cost, 0, h->mb.i_mb_count * sizeof(uint16_t) );
+            if( !incremental )
+                memset( frames[middle]->i_propagate_cost, 0, h->mb.i_mb_count * sizeof(uint16_t) );
             while( i > cur_nonb )
             {
                 int p0 = i > middle ? middle : cur_nonb;
@@ -1145,35 +1554,35 @@ static void macroblock_tree( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **fr
                 if( i != middle )
                 {
                     slicetype_frame_cost( h, a, frames, p0, p1, i );
-                    macroblock_tree_propagate( h, frames, average_duration, p0, p1, i, 0 );
+                    macroblock_tree_send( h, frames, average_duration, p0, p1, i, 0, sweep_start, sweep_end );
                 }
                 i--;
             }
-            macroblock_tree_propagate( h, frames, average_duration, cur_nonb, last_nonb, middle, 1 );
+            macroblock_tree_send( h, frames, average_duration, cur_nonb, last_nonb, middle, 1, sweep_start, sweep_end );
         }
         else
         {
             while( i > cur_nonb )
             {
                 slicetype_frame_cost( h, a, frames, cur_nonb, last_nonb, i );
-                macroblock_tree_propagate( h, frames, average_duration, cur_nonb, last_nonb, i, 0 );
+                macroblock_tree_send( h, frames, average_duration, cur_nonb, last_nonb, i, 0, sweep_start, sweep_end );
                 i--;
             }
         }
-        macroblock_tree_propagate( h, frames, average_duration, cur_nonb, last_nonb, last_nonb, 1 );
+        macroblock_tree_send( h, frames, average_duration, cur_nonb, last_nonb, last_nonb, 1, sweep_start, sweep_end );
         last_nonb = cur_nonb;
     }
 
     if( !h->param.rc.i_lookahead )
     {
         slicetype_frame_cost( h, a, frames, 0, last_nonb, last_nonb );
-        macroblock_tree_propagate( h, frames, average_duration, 0, last_nonb, last_nonb, 1 );
+        macroblock_tree_propagate( h, frames, average_duration, 0, last_nonb, last_nonb, 1, 0 );
         XCHG( uint16_t*, frames[last_nonb]->i_propagate_cost, frames[0]->i_propagate_cost );
     }
 
-    macroblock_tree_finish( h, frames[last_nonb], average_duration, last_nonb );
+    macroblock_tree_finish( h, frames, average_duration, last_nonb, last_nonb );
     if( h->param.i_bframe_pyramid && bframes > 1 && !h->param.rc.i_vbv_buffer_size )
-        macroblock_tree_finish( h, frames[last_nonb+(bframes+1)/2], average_duration, 0 );
+        macroblock_tree_finish( h, frames, average_duration, last_nonb+(bframes+1)/2, 0 );
 }
 
 static int vbv_frame_cost( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **frames, int p0, int p1, int b )
@@ -1182,7 +1591,14 @@ static int vbv_frame_cost( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **fram
     if( h->param.rc.i_aq_mode )
     {
         if( h->param.rc.b_mb_tree )
-            return slicetype_frame_cost_recalculate( h, frames, p0, p1, b );
+        {
+            /* The quantizers only change when MB-tree finishes a frame, so this is usually
+             * the same as in the previous lookahead call. */
+            int *recalc = &frames[b]->i_cost_recalc[IS_X264_TYPE_B(frames[b]->i_type)][b-p0][p1-b];
+            if( *recalc < 0 )
+                *recalc = slicetype_frame_cost_recalculate( h, frames, p0, p1, b );
+            return *recalc;
+        }
         else
             return frames[b]->i_cost_est_aq[b-p0][p1-b];
     }
@@ -1230,6 +1646,20 @@ static void vbv_lookahead( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **fram
         h->i_cpb_delay_lookahead = frames[cur_nonb]->i_cpb_delay_lookahead;
     }
 
+    int costs[X264_LOOKAHEAD_MAX+2][3];
+    int num_costs = 0;
+    for( int last = last_nonb, cur = cur_nonb; cur < num_frames; )
+    {
+        if( next_nonb != cur )
+            slicetype_frame_cost_add( costs, &num_costs, IS_X264_TYPE_I( frames[cur]->i_type ) ? cur : last, cur, cur );
+        for( int i = last+1; i < cur; i++ )
+            slicetype_frame_cost_add( costs, &num_costs, last, cur, i );
+        last = cur++;
+        while( cur <= num_frames && IS_X264_TYPE_B( frames[cur]->i_type ) )
+            cur++;
+    }
+    slicetype_frame_cost_batch( h, a, frames, costs, num_costs );
+
     while( cur_nonb < num_frames )
     {
         /* P/I cost: This shouldn't include the cost of next_nonb */
@@ -1278,6 +1708,187 @@ static void vbv_lookahead( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **fram
     frames[next_nonb]->i_planned_type[idx] = X264_TYPE_AUTO;
 }
 
+/* Coarse lookahead: a cut-down slicetype_mb_cost on the quarter-size plane, where each 8x8 block
+ * stands in for 2x2 lowres blocks. Only whole-frame costs are kept, for the frametype decisions;
+ * mbtree and VBV still cost the frames they need on the lowres plane. */
+static int slicetype_coarse_block_cost( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **frames,
+                                        int p0, int p1, int b, int x, int y, int dist_scale_factor,
+                                        int do_search[2], int b_intra_calculated )
+{
+    x264_frame_t *fenc = frames[b];
+    const int b_bidir = b < p1;
+    const int i_width = COARSE_WIDTH( fenc );
+    const int i_height = COARSE_HEIGHT( fenc );
+    const int i_xy = x + y * i_width;
+    const int i_stride = fenc->i_stride_coarse;
+    const int i_pel_offset = 8 * (x + y * i_stride);
+    const int i_bipred_weight = h->param.analyse.b_weighted_bipred ? 64 - (dist_scale_factor>>2) : 32;
+    const int lowres_penalty = 4;
+    ALIGNED_ARRAY_16( pixel, pix1,[9*FDEC_STRIDE] );
+    pixel *pix2 = pix1+8;
+    x264_me_t m[2];
+    int i_bcost = COST_MAX;
+
+    h->mb.pic.p_fenc[0] = h->mb.pic.fenc_buf;
+    h->mc.copy[PIXEL_8x8]( h->mb.pic.p_fenc[0], FENC_STRIDE, &fenc->coarse[0][i_pel_offset], i_stride, 8 );
+
+    if( p0 != p1 )
+    {
+        int mv_range = h->param.analyse.i_mv_range;
+        h->mb.mv_min_spel[0] = X264_MAX( 4*(-8*x - 12), -mv_range );
+        h->mb.mv_max_spel[0] = X264_MIN( 4*(8*(i_width - x - 1) + 12), mv_range-1 );
+        h->mb.mv_min_spel[1] = X264_MAX( 4*(-8*y - 12), -mv_range );
+        h->mb.mv_max_spel[1] = X264_MIN( 4*(8*(i_height - y - 1) + 12), mv_range-1 );
+        for( int i = 0; i < 2; i++ )
+        {
+            h->mb.mv_limit_fpel[0][i] = h->mb.mv_min_spel[i] >> 2;
+            h->mb.mv_limit_fpel[1][i] = h->mb.mv_max_spel[i] >> 2;
+        }
+
+        for( int l = 0; l < 1 + b_bidir; l++ )
+        {
+            x264_frame_t *fref = frames[l ? p1 : p0];
+            int i_dist = l ? p1-b : b-p0;
+            int16_t (*fenc_mv)[2] = &fenc->coarse_mvs[l][i_dist-1][i_xy];
+            int *fenc_cost = &fenc->coarse_mv_costs[l][i_dist-1][i_xy];
+
+            m[l].i_pixel = PIXEL_8x8;
+            m[l].p_cost_mv = a->p_cost_mv;
+            m[l].i_stride[0] = i_stride;
+            m[l].p_fenc[0] = h->mb.pic.p_fenc[0];
+            m[l].weight = x264_weight_none;
+            m[l].i_ref = 0;
+            for( int i = 0; i < 4; i++ )
+                m[l].p_fref[i] = &fref->coarse[i][i_pel_offset];
+            m[l].p_fref_w = m[l].p_fref[0];
+
+            if( do_search[l] )
+            {
+                int i_mvc = 0;
+                ALIGNED_4( int16_t mvc[4][2] );
+
+                /* Reverse-order MV prediction, as in slicetype_mb_cost. */
+                M32( mvc[0] ) = 0;
+                M32( mvc[2] ) = 0;
+#define MVC(mv) { CP32( mvc[i_mvc], mv ); i_mvc++; }
+                if( x < i_width - 1 )
+                    MVC( fenc_mv[1] );
+                if( y < i_height - 1 )
+                {
+                    MVC( fenc_mv[i_width] );
+                    if( x > 0 )
+                        MVC( fenc_mv[i_width-1] );
+                    if( x < i_width - 1 )
+                        MVC( fenc_mv[i_width+1] );
+                }
+#undef MVC
+                if( i_mvc <= 1 )
+                    CP32( m[l].mvp, mvc[0] );
+                else
+                    x264_median_mv( m[l].mvp, mvc[0], mvc[1], mvc[2] );
+
+                x264_me_search( h, &m[l], mvc, i_mvc );
+                m[l].cost -= a->p_cost_mv[0];
+                if( M32( m[l].mv ) )
+                    m[l].cost += 5 * a->i_lambda;
+                CP32( fenc_mv[0], m[l].mv );
+                *fenc_cost = m[l].cost;
+            }
+            else
+            {
+                CP32( m[l].mv, fenc_mv[0] );
+                m[l].cost = *fenc_cost;
+            }
+            i_bcost = X264_MIN( i_bcost, m[l].cost );
+        }
+
+        if( b_bidir )
+        {
+            intptr_t stride1 = 16, stride2 = 16;
+            pixel *src1 = h->mc.get_ref( pix1, &stride1, m[0].p_fref, m[0].i_stride[0],
+                                         m[0].mv[0], m[0].mv[1], 8, 8, x264_weight_none );
+            pixel *src2 = h->mc.get_ref( pix2, &stride2, m[1].p_fref, m[1].i_stride[0],
+                                         m[1].mv[0], m[1].mv[1], 8, 8, x264_weight_none );
+            h->mc.avg[PIXEL_8x8]( pix1, 16, src1, stride1, src2, stride2, i_bipred_weight );
+            int i_cost = 5 * a->i_lambda + h->pixf.mbcmp[PIXEL_8x8]( m[0].p_fenc[0], FENC_STRIDE, pix1, 16 );
+            i_bcost = X264_MIN( i_bcost, i_cost );
+        }
+    }
+
+    if( !b_intra_calculated )
+    {
+        pixel *pix = &pix1[8+FDEC_STRIDE];
+        pixel *src = &fenc->coarse[0][i_pel_offset];
+        int pixoff = 4 / sizeof(pixel);
+        int satds[3];
+
+        memcpy( pix-FDEC_STRIDE, src-i_stride, 16 * sizeof(pixel) );
+        for( int i = -1; i < 8; i++ )
+            M32( &pix[i*FDEC_STRIDE-pixoff] ) = M32( &src[i*i_stride-pixoff] );
+
+        h->pixf.intra_mbcmp_x3_8x8c( h->mb.pic.p_fenc[0], pix, satds );
+        int i_icost = X264_MIN3( satds[0], satds[1], satds[2] );
+        fenc->i_coarse_intra_cost[i_xy] = ((i_icost + 5 * a->i_lambda) >> (BIT_DEPTH - 8)) + lowres_penalty;
+    }
+
+    if( p0 == p1 )
+        return fenc->i_coarse_intra_cost[i_xy];
+
+    i_bcost = (i_bcost >> (BIT_DEPTH - 8)) + lowres_penalty;
+    /* As in slicetype_mb_cost, intra blocks are only allowed in P-frames. */
+    if( !b_bidir )
+        i_bcost = X264_MIN( i_bcost, fenc->i_coarse_intra_cost[i_xy] );
+    return i_bcost;
+}
+
+static int slicetype_coarse_cost( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **frames, int p0, int p1, int b )
+{
+    x264_frame_t *fenc = frames[b];
+    if( fenc->i_coarse_cost[b-p0][p1-b] >= 0 )
+        return fenc->i_coarse_cost[b-p0][p1-b];
+
+    const int i_width = COARSE_WIDTH( fenc );
+    const int i_height = COARSE_HEIGHT( fenc );
+    int b_intra_calculated = fenc->i_coarse_cost[0][0] >= 0;
+    int dist_scale_factor = p1 != p0 ? ( ((b-p0) << 8) + ((p1-p0) >> 1) ) / (p1-p0) : 128;
+    int search0 = b != p0 && fenc->coarse_mvs[0][b-p0-1][0][0] == 0x7FFF;
+    int search1 = b != p1 && fenc->coarse_mvs[1][p1-b-1][0][0] == 0x7FFF;
+    int do_search[2] = { search0, search1 };
+    int i_cost = 0;
+    int i_intra_cost = 0;
+
+    /* Backwards, like the lowres lookahead, so the predictors match. */
+    for( int y = i_height - 1; y >= 0; y-- )
+        for( int x = i_width - 1; x >= 0; x-- )
+        {
+            int i_bcost = slicetype_coarse_block_cost( h, a, frames, p0, p1, b, x, y, dist_scale_factor,
+                                                       do_search, b_intra_calculated );
+            /* Skip the edge blocks in the frame score, as slicetype_mb_cost does. */
+            if( (x > 0 && x < i_width - 1 && y > 0 && y < i_height - 1) || i_width <= 2 || i_height <= 2 )
+            {
+                i_cost += i_bcost;
+                if( !b_intra_calculated )
+                    i_intra_cost += fenc->i_coarse_intra_cost[x + y * i_width];
+            }
+        }
+
+    if( !b_intra_calculated )
+        fenc->i_coarse_cost[0][0] = i_intra_cost;
+    if( b != p1 )
+        i_cost = (uint64_t)i_cost * 100 / (120 + h->param.i_bframe_bias);
+    fenc->i_coarse_cost[b-p0][p1-b] = i_cost;
+    x264_emms();
+    return i_cost;
+}
+
+/* The cost of a frame for the frametype decisions. */
+static int slicetype_decision_cost( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **frames, int p0, int p1, int b )
+{
+    if( h->frames.b_have_coarse )
+        return slicetype_coarse_cost( h, a, frames, p0, p1, b );
+    return slicetype_frame_cost( h, a, frames, p0, p1, b );
+}
+
 static uint64_t slicetype_path_cost( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **frames, char *path, uint64_t threshold )
 {
     uint64_t cost = 0;
@@ -1293,9 +1904,9 @@ static uint64_t slicetype_path_cost( x264_t *h, x264_mb_analysis_t *a, x264_fram
 
         /* Add the cost of the non-B-frame found above */
         if( path[next_nonb] == 'P' )
-            cost += slicetype_frame_cost( h, a, frames, cur_nonb, next_nonb, next_nonb );
+            cost += slicetype_decision_cost( h, a, frames, cur_nonb, next_nonb, next_nonb );
         else /* I-frame */
-            cost += slicetype_frame_cost( h, a, frames, next_nonb, next_nonb, next_nonb );
+            cost += slicetype_decision_cost( h, a, frames, next_nonb, next_nonb, next_nonb );
         /* Early terminate if the cost we have found is larger than the best path cost so far */
         if( cost > threshold )
             break;
@@ -1303,15 +1914,15 @@ static uint64_t slicetype_path_cost( x264_t *h, x264_mb_analysis_t *a, x264_fram
         if( h->param.i_bframe_pyramid && next_nonb - cur_nonb > 2 )
         {
             int middle = cur_nonb + (next_nonb - cur_nonb)/2;
-            cost += slicetype_frame_cost( h, a, frames, cur_nonb, next_nonb, middle );
+            cost += slicetype_decision_cost( h, a, frames, cur_nonb, next_nonb, middle );
             for( int next_b = loc; next_b < middle && cost < threshold; next_b++ )
-                cost += slicetype_frame_cost( h, a, frames, cur_nonb, middle, next_b );
+                cost += slicetype_decision_cost( h, a, frames, cur_nonb, middle, next_b );
             for( int next_b = middle+1; next_b < next_nonb && cost < threshold; next_b++ )
-                cost += slicetype_frame_cost( h, a, frames, middle, next_nonb, next_b );
+                cost += slicetype_decision_cost( h, a, frames, middle, next_nonb, next_b );
         }
         else
             for( int next_b = loc; next_b < next_nonb && cost < threshold; next_b++ )
-                cost += slicetype_frame_cost( h, a, frames, cur_nonb, next_nonb, next_b );
+                cost += slicetype_decision_cost( h, a, frames, cur_nonb, next_nonb, next_b );
 
         loc = next_nonb + 1;
         cur_nonb = next_nonb;
@@ -1319,59 +1930,212 @@ static uint64_t slicetype_path_cost( x264_t *h, x264_mb_analysis_t *a, x264_fram
     return cost;
 }
 
+/* The frame costs slicetype_path_cost() will need for a path, in the same order. */
+static void slicetype_path_cost_list( x264_t *h, char *path, int (*list)[3], int *count )
+{
+    int loc = 1;
+    int cur_nonb = 0;
+    path--;
+    while( path[loc] )
+    {
+        int next_nonb = loc;
+        while( path[next_nonb] == 'B' )
+            next_nonb++;
+
+        slicetype_frame_cost_add( list, count, path[next_nonb] == 'P' ? cur_nonb : next_nonb, next_nonb, next_nonb );
+        if( h->param.i_bframe_pyramid && next_nonb - cur_nonb > 2 )
+        {
+            int middle = cur_nonb + (next_nonb - cur_nonb)/2;
+            slicetype_frame_cost_add( list, count, cur_nonb, next_nonb, middle );
+            for( int next_b = loc; next_b < middle; next_b++ )
+                slicetype_frame_cost_add( list, count, cur_nonb, middle, next_b );
+            for( int next_b = middle+1; next_b < next_nonb; next_b++ )
+                slicetype_frame_cost_add( list, count, middle, next_nonb, next_b );
+        }
+        else
+            for( int next_b = loc; next_b < next_nonb; next_b++ )
+                slicetype_frame_cost_add( list, count, cur_nonb, next_nonb, next_b );
+
+        loc = next_nonb + 1;
+        cur_nonb = next_nonb;
+    }
+}
+
+/* Cost the candidate paths of slicetype_path() on the lookahead threads before it walks them.
+ * Each round takes the next few uncosted frames of every path still in the running and costs
+ * the lot as one batch; the frames' cost caches are the memo the paths share, and each frame
+ * is only ever costed by one thread at a time. A path is dropped as soon as its partial cost
+ * exceeds the best complete path, using the same thresholds slicetype_path() would, so the
+ * serial walk afterwards finds what it needs already costed. */
+static void slicetype_path_prefetch( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **frames,
+                                     char (*paths)[X264_LOOKAHEAD_MAX+1], int *possible, int num_paths )
+{
+    int threads = h->param.i_lookahead_threads;
+    int list[X264_LOOKAHEAD_MAX+1][3];
+    int batch[X264_LOOKAHEAD_THREAD_MAX+X264_BFRAME_MAX+1][3];
+    int pos[X264_BFRAME_MAX+1] = {0};
+    int live[X264_BFRAME_MAX+1];
+    uint64_t partial[X264_BFRAME_MAX+1] = {0};
+    uint64_t best_cost[2] = { COST_MAX64, COST_MAX64 };
+
+    if( threads <= 1 || h->param.b_opencl || h->frames.b_have_coarse )
+        return;
+
+    for( int path = 0; path < num_paths; path++ )
+        live[path] = 1;
+
+    for( ;; )
+    {
+        int num_live = 0;
+        for( int path = 0; path < num_paths; path++ )
+        {
+            if( !live[path] )
+                continue;
+            int count = 0;
+            slicetype_path_cost_list( h, paths[path], list, &count );
+            while( pos[path] < count )
+            {
+                int p0 = list[pos[path]][0], p1 = list[pos[path]][1], b = list[pos[path]][2];
+                if( !slicetype_frame_cost_done( h, frames[b], p0, p1, b ) )
+                    break;
+                partial[path] += frames[b]->i_cost_est[b-p0][p1-b];
+                pos[path]++;
+            }
+            if( partial[path] > best_cost[possible[path]] )
+                live[path] = 0;
+            else if( pos[path] == count )
+            {
+                best_cost[possible[path]] = partial[path];
+                live[path] = 0;
+            }
+            else
+                num_live++;
+        }
+        if( !num_live )
+            break;
+
+        int per_path = X264_MAX( threads / num_live, 1 );
+        int num_batch = 0;
+        for( int path = 0; path < num_paths; path++ )
+        {
+            if( !live[path] )
+                continue;
+            int count = 0;
+            slicetype_path_cost_list( h, paths[path], list, &count );
+            for( int i = pos[path]; i < X264_MIN( pos[path] + per_path, count ); i++ )
+            {
+                int dup = 0;
+                for( int j = 0; j < num_batch && !dup; j++ )
+                    dup = !memcmp( batch[j], list[i], sizeof(list[i]) );
+                if( !dup )
+                    slicetype_frame_cost_add( batch, &num_batch, list[i][0], list[i][1], list[i][2] );
+            }
+        }
+        slicetype_frame_cost_batch( h, a, frames, batch, num_batch );
+    }
+}
+
 /* Viterbi/trellis slicetype decision algorithm. */
 /* Uses strings due to the fact that the speed of the control functions is
    negligible compared to the cost of running slicetype_frame_cost, and because
    it makes debugging easier. */
 static void slicetype_path( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **frames, int length, char (*best_paths)[X264_LOOKAHEAD_MAX+1] )
 {
-    char paths[2][X264_LOOKAHEAD_MAX+1];
+    char paths[X264_BFRAME_MAX+1][X264_LOOKAHEAD_MAX+1];
+    int possible[X264_BFRAME_MAX+1];
     int num_paths = X264_MIN( h->param.i_bframe+1, length );
     uint64_t best_cost = COST_MAX64;
     int best_possible = 0;
-    int idx = 0;
+    int best_path = 0;
 
-    /* Iterate over all currently possible paths */
+    /* Build all currently possible paths */
     for( int path = 0; path < num_paths; path++ )
     {
         /* Add suffixes to the current path */
         int len = length - (path + 1);
-        memcpy( paths[idx], best_paths[len % (X264_BFRAME_MAX+1)], len );
-        memset( paths[idx]+len, 'B', path );
-        strcpy( paths[idx]+len+path, "P" );
+        memcpy( paths[path], best_paths[len % (X264_BFRAME_MAX+1)], len );
+        memset( paths[path]+len, 'B', path );
+        strcpy( paths[path]+len+path, "P" );
 
-        int possible = 1;
+        possible[path] = 1;
         for( int i = 1; i <= length; i++ )
         {
             int i_type = frames[i]->i_type;
             if( i_type == X264_TYPE_AUTO )
                 continue;
             if( IS_X264_TYPE_B( i_type ) )
-                possible = possible && (i < len || i == length || paths[idx][i-1] == 'B');
+                possible[path] = possible[path] && (i < len || i == length || paths[path][i-1] == 'B');
             else
             {
-                possible = possible && (i < len || paths[idx][i-1] != 'B');
-                paths[idx][i-1] = IS_X264_TYPE_I( i_type ) ? 'I' : 'P';
+                possible[path] = possible[path] && (i < len || paths[path][i-1] != 'B');
+                paths[path][i-1] = IS_X264_TYPE_I( i_type ) ? 'I' : 'P';
             }
         }
+    }
+
+    slicetype_path_prefetch( h, a, frames, paths, possible, num_paths );
 
-        if( possible || !best_possible )
+    /* Iterate over all currently possible paths */
+    for( int path = 0; path < num_paths; path++ )
+    {
+        if( possible[path] || !best_possible )
         {
-            if( possible && !best_possible )
+            if( possible[path] && !best_possible )
                 best_cost = COST_MAX64;
             /* Calculate the actual cost of the current path */
-            uint64_t cost = slicetype_path_cost( h, a, frames, paths[idx], best_cost );
+            uint64_t cost = slicetype_path_cost( h, a, frames, paths[path], best_cost );
             if( cost < best_cost )
             {
                 best_cost = cost;
-                best_possible = possible;
-                idx ^= 1;
+                best_possible = possible[path];
+                best_path = path;
             }
         }
     }
 
     /* Store the best path. */
-    memcpy( best_paths[length % (X264_BFRAME_MAX+1)], paths[idx^1], length );
+    memcpy( best_paths[length % (X264_BFRAME_MAX+1)], paths[best_path], length );
+}
+
+static float histogram_distance( uint32_t *hist0, uint32_t *hist1, int bins )
+{
+    int count = 0, diff = 0;
+    for( int i = 0; i < bins; i++ )
+    {
+        count += hist0[i];
+        diff += abs( (int)hist0[i] - (int)hist1[i] );
+    }
+    return count ? diff / (2.0f * count) : 0;
+}
+
+/* Compare two frames by their histograms and lowres block sums.
+ * Returns 0 if they are clearly the same scene, 1 if they are clearly not (only if b_allow_cut),
+ * and -1 if the frame costs have to decide. */
+static int scenecut_prefilter( x264_t *h, x264_frame_t *prev, x264_frame_t *frame, int b_allow_cut )
+{
+    float luma_dist = histogram_distance( prev->i_luma_hist, frame->i_luma_hist, 32 );
+    float chroma_dist = X264_MAX( histogram_distance( prev->i_chroma_hist[0], frame->i_chroma_hist[0], 16 ),
+                                  histogram_distance( prev->i_chroma_hist[1], frame->i_chroma_hist[1], 16 ) );
+    /* Mean absolute difference of the 8x8 block averages, in 8-bit units, after scaling
+     * the previous frame to the brightness of this one: weightp predicts fades well,
+     * so a change of brightness alone doesn't make a scenecut. */
+    int64_t sum0 = 0, sum1 = 0;
+    for( int i = 0; i < h->mb.i_mb_count; i++ )
+    {
+        sum0 += prev->i_lowres_dc[i];
+        sum1 += frame->i_lowres_dc[i];
+    }
+    float scale = sum0 ? (float)sum1 / sum0 : 1.0f;
+    float dc_diff = 0;
+    for( int i = 0; i < h->mb.i_mb_count; i++ )
+        dc_diff += fabsf( prev->i_lowres_dc[i] * scale - frame->i_lowres_dc[i] );
+    float dc_dist = dc_diff / (64.0f * h->mb.i_mb_count * (1 << (BIT_DEPTH-8)));
+
+    if( luma_dist < 0.1f && chroma_dist < 0.1f && dc_dist < 3.0f )
+        return 0;
+    if( b_allow_cut && luma_dist > 0.5f && dc_dist > 24.0f )
+        return 1;
+    return -1;
 }
 
 static int scenecut_internal( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **frames, int p0, int p1, int real_scenecut )
@@ -1382,10 +2146,6 @@ static int scenecut_internal( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **f
     if( real_scenecut && h->param.i_frame_packing == 5 && (frame->i_frame&1) )
         return 0;
 
-    slicetype_frame_cost( h, a, frames, p0, p1, p1 );
-
-    int icost = frame->i_cost_est[0][0];
-    int pcost = frame->i_cost_est[p1-p0][0];
     float f_bias;
     int i_gop_size = frame->i_frame - h->lookahead->i_last_keyframe;
     float f_thresh_max = h->param.i_scenecut_threshold / 100.0;
@@ -1407,6 +2167,33 @@ static int scenecut_internal( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **f
                  / ( h->param.i_keyint_max - h->param.i_keyint_min );
     }
 
+    /* Frames that are obviously (not) a scenecut don't need their costs.  Obvious cuts
+     * are only taken as such when the gop is long enough for the bias to allow them. */
+    if( h->param.b_scenecut_prefilter )
+    {
+        res = scenecut_prefilter( h, frames[p0], frame, f_bias >= f_thresh_min );
+        if( res >= 0 )
+        {
+            if( res && real_scenecut )
+                x264_log( h, X264_LOG_DEBUG, "scene cut at %d from histograms bias:%.4f gop:%d\n",
+                          frame->i_frame, f_bias, i_gop_size );
+            return res;
+        }
+    }
+
+    /* With the coarse lookahead, only frames that look like a scenecut on the
+     * quarter-size plane are checked again on the lowres one. */
+    if( h->frames.b_have_coarse )
+    {
+        slicetype_coarse_cost( h, a, frames, p0, p1, p1 );
+        if( frame->i_coarse_cost[p1-p0][0] < (1.0 - f_bias) * frame->i_coarse_cost[0][0] )
+            return 0;
+    }
+
+    slicetype_frame_cost( h, a, frames, p0, p1, p1 );
+
+    int icost = frame->i_cost_est[0][0];
+    int pcost = frame->i_cost_est[p1-p0][0];
     res = pcost >= (1.0 - f_bias) * icost;
     if( res && real_scenecut )
     {
@@ -1434,6 +2221,18 @@ static int scenecut( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **frames, in
             origmaxp1++;
         int maxp1 = X264_MIN( origmaxp1, num_frames );
 
+        int costs[X264_BFRAME_MAX*2+4][3];
+        int num_costs = 0;
+        for( int curp1 = p1; curp1 <= maxp1; curp1++ )
+            if( !h->param.b_scenecut_prefilter || scenecut_prefilter( h, frames[p0], frames[curp1], 0 ) )
+                slicetype_frame_cost_add( costs, &num_costs, p0, curp1, curp1 );
+        if( origmaxp1 <= i_max_search )
+            for( int curp0 = p0; curp0 < maxp1; curp0++ )
+                if( !h->param.b_scenecut_prefilter || scenecut_prefilter( h, frames[curp0], frames[maxp1], 0 ) )
+                    slicetype_frame_cost_add( costs, &num_costs, curp0, maxp1, maxp1 );
+        if( !h->frames.b_have_coarse )
+            slicetype_frame_cost_batch( h, a, frames, costs, num_costs );
+
         /* Where A and B are scenes: AAAAAABBBAAAAAA
          * If BBB is shorter than (maxp1-p0), it is detected as a flash
          * and not considered a scenecut. */
@@ -1601,7 +2400,16 @@ void x264_slicetype_analyse( x264_t *h, int intra_minigop )
                 }
 
                 int bframes = j - last_nonb - 1;
+                int costs[2*X264_BFRAME_MAX+4][3];
+                int num_costs = 0;
                 memset( path, 'B', bframes );
+                strcpy( path+bframes, "PP" );
+                slicetype_path_cost_list( h, path, costs, &num_costs );
+                strcpy( path+bframes, "BP" );
+                slicetype_path_cost_list( h, path, costs, &num_costs );
+                if( !h->frames.b_have_coarse )
+                    slicetype_frame_cost_batch( h, &a, frames+last_nonb, costs, num_costs );
+
                 strcpy( path+bframes, "PP" );
                 uint64_t cost_p = slicetype_path_cost( h, &a, frames+last_nonb, path, COST_MAX64 );
                 strcpy( path+bframes, "BP" );
@@ -1735,6 +2543,68 @@ void x264_slicetype_analyse( x264_t *h, int intra_minigop )
 #endif
 }
 
+/* Lookahead-only mode: keep the cost of the frametype the frame was given.
+ * Intra blocks are only counted for P-frames. */
+static void slicetype_decided_cost( x264_t *h, x264_frame_t **frames, int p0, int p1, int b )
+{
+    frames[b]->i_decided_cost = frames[b]->i_cost_est[b-p0][p1-b];
+    frames[b]->f_decided_intra_mbs = p0 == b ? 1.0f : b != p1 ? -1.0f : (float)frames[b]->i_intra_mbs[b-p0] / NUM_MBS;
+}
+
+/* Flag the mbs whose lowres block matches the nearest reference in each direction at zero motion
+ * to within an average of 1/2 per pixel (in 8-bit units), so that analysis can skip them outright. */
+static void slicetype_static_map( x264_t *h, x264_frame_t *frame, x264_frame_t *ref0, x264_frame_t *ref1 )
+{
+    int stride = frame->i_stride_lowres;
+    int thresh = 32 << (BIT_DEPTH-8);
+    for( int y = 0, mb_xy = 0; y < h->mb.i_mb_height; y++ )
+        for( int x = 0; x < h->mb.i_mb_width; x++, mb_xy++ )
+        {
+            int offset = 8 * (y * stride + x);
+            pixel *src = frame->lowres[0] + offset;
+            frame->static_mb[mb_xy] = h->pixf.sad[PIXEL_8x8]( src, stride, ref0->lowres[0] + offset, stride ) <= thresh
+                && (!ref1 || h->pixf.sad[PIXEL_8x8]( src, stride, ref1->lowres[0] + offset, stride ) <= thresh);
+        }
+}
+
+static int frame_planes_equal( x264_t *h, x264_frame_t *a, x264_frame_t *b )
+{
+    for( int p = 0; p < a->i_plane; p++ )
+        for( int y = 0; y < a->i_lines[p]; y++ )
+            if( memcmp( a->plane[p] + y * a->i_stride[p], b->plane[p] + y * b->i_stride[p], a->i_width[p] * sizeof(pixel) ) )
+                return 0;
+    return 1;
+}
+
+/* 1 if the frame is identical to its nearest references, 2 if it nearly is (no lowres block differs by more
+ * than an average of 2 per pixel, and the whole frame by more than 1/2), 0 otherwise. */
+static int slicetype_duplicate( x264_t *h, x264_frame_t *frame, x264_frame_t *ref0, x264_frame_t *ref1 )
+{
+    x264_frame_t *refs[2] = { ref0, ref1 };
+    int stride = frame->i_stride_lowres;
+    int block_thresh = 128 << (BIT_DEPTH-8);
+    int64_t frame_thresh = (int64_t)(32 << (BIT_DEPTH-8)) * h->mb.i_mb_count;
+    int dup = 1;
+    for( int l = 0; l < 2 && refs[l]; l++ )
+    {
+        int64_t sum = 0;
+        for( int y = 0; y < h->mb.i_mb_height; y++ )
+            for( int x = 0; x < h->mb.i_mb_width; x++ )
+            {
+                int offset = 8 * (y * stride + x);
+                int sad = h->pixf.sad[PIXEL_8x8]( frame->lowres[0] + offset, stride, refs[l]->lowres[0] + offset, stride );
+                if( sad > block_thresh )
+                    return 0;
+                sum += sad;
+            }
+        if( sum > frame_thresh )
+            return 0;
+        if( sum || !frame_planes_equal( h, frame, refs[l] ) )
+            dup = 2;
+    }
+    return dup == 1 || h->param.analyse.i_dup_skip >= 2 ? dup : 0;
+}
+
 void x264_slicetype_decide( x264_t *h )
 {
     x264_frame_t *frames[X264_BFRAME_MAX+2];
@@ -1888,8 +2758,36 @@ void x264_slicetype_decide( x264_t *h )
         brefs++;
     }
 
+    /* The nearest references of each frame of the minigop: the B-refs, the last non-B and the P/I-frame.
+     * The P/I-frame is coded before the B-refs, so it only has the last non-B to refer to. */
+    if( (h->param.analyse.b_static_skip || h->param.analyse.i_dup_skip) && h->lookahead->last_nonb )
+    {
+        x264_frame_t *last_ref0 = h->lookahead->last_nonb;
+        for( int i = 0; i <= bframes; i++ )
+        {
+            x264_frame_t *cur = h->lookahead->next.list[i];
+            x264_frame_t *ref0 = i == bframes ? h->lookahead->last_nonb : last_ref0;
+            x264_frame_t *ref1 = NULL;
+            if( i < bframes )
+                for( int j = bframes; j > i; j-- )
+                    if( j == bframes || h->lookahead->next.list[j]->i_type == X264_TYPE_BREF )
+                        ref1 = h->lookahead->next.list[j];
+            if( !IS_X264_TYPE_I( cur->i_type ) )
+            {
+                cur->i_static_ref[0] = ref0->i_frame;
+                cur->i_static_ref[1] = ref1 ? ref1->i_frame : -1;
+                if( h->param.analyse.b_static_skip )
+                    slicetype_static_map( h, cur, ref0, ref1 );
+                if( h->param.analyse.i_dup_skip )
+                    cur->i_duplicate = slicetype_duplicate( h, cur, ref0, ref1 );
+            }
+            if( cur->i_type == X264_TYPE_BREF )
+                last_ref0 = cur;
+        }
+    }
+
     /* calculate the frame costs ahead of time for x264_rc_analyse_slice while we still have lowres */
-    if( h->param.rc.i_rc_method != X264_RC_CQP )
+    if( h->param.rc.i_rc_method != X264_RC_CQP || h->param.b_lookahead_only )
     {
         x264_mb_analysis_t a;
         int p0, p1, b;
@@ -1905,8 +2803,10 @@ void x264_slicetype_decide( x264_t *h )
             p0 = 0;
 
         slicetype_frame_cost( h, &a, frames, p0, p1, b );
+        if( h->param.b_lookahead_only )
+            slicetype_decided_cost( h, frames, p0, p1, b );
 
-        if( (p0 != p1 || bframes) && h->param.rc.i_vbv_buffer_size )
+        if( (p0 != p1 || bframes) && (h->param.rc.i_vbv_buffer_size || h->param.b_lookahead_only) )
         {
             /* We need the intra costs for row SATDs. */
             slicetype_frame_cost( h, &a, frames, b, b, b );
@@ -1921,6 +2821,8 @@ void x264_slicetype_decide( x264_t *h )
                 else
                     p1 = bframes + 1;
                 slicetype_frame_cost( h, &a, frames, p0, p1, b );
+                if( h->param.b_lookahead_only )
+                    slicetype_decided_cost( h, frames, p0, p1, b );
                 if( frames[b]->i_type == X264_TYPE_BREF )
                     p0 = b;
             }
@@ -1966,6 +2868,44 @@ void x264_slicetype_decide( x264_t *h )
     }
 }
 
+/* Lookahead cost of each macroblock row of the frame about to be encoded, for sizing
+ * sliced-thread slices. Returns 0 if the lookahead didn't cost this frame. */
+int x264_slicetype_row_costs( x264_t *h, int *row_cost )
+{
+    int p0 = 0, p1, b;
+
+    if( !h->frames.b_have_lowres )
+        return 0;
+    if( IS_X264_TYPE_I(h->fenc->i_type) )
+        p1 = b = 0;
+    else if( h->fenc->i_type == X264_TYPE_P )
+        p1 = b = h->fenc->i_bframes + 1;
+    else //B
+    {
+        p1 = (h->fref_nearest[1]->i_poc - h->fref_nearest[0]->i_poc)/2;
+        b  = (h->fenc->i_poc - h->fref_nearest[0]->i_poc)/2;
+    }
+    if( h->fenc->i_cost_est[b-p0][p1-b] < 0 )
+        return 0;
+
+    /* Without edges, only the inner macroblocks were costed, so take the outer rows
+     * from their neighbours. */
+    uint16_t *lowres_costs = h->fenc->lowres_costs[b-p0][p1-b];
+    int edge = !lowres_do_edges( h );
+    for( int y = edge; y < h->mb.i_mb_height - edge; y++ )
+    {
+        row_cost[y] = 0;
+        for( int x = edge; x < h->mb.i_mb_width - edge; x++ )
+            row_cost[y] += lowres_costs[x + y*h->mb.i_mb_stride] & LOWRES_COST_MASK;
+    }
+    if( edge )
+    {
+        row_cost[0] = row_cost[1];
+        row_cost[h->mb.i_mb_height-1] = row_cost[h->mb.i_mb_height-2];
+    }
+    return 1;
+}
+
 int x264_rc_analyse_slice( x264_t *h )
 {
     int p0 = 0, p1, b;
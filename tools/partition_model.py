@@ -0,0 +1,198 @@
+#!/usr/bin/env python3
+"""Train the decision trees behind x264's --partition-model.
+
+Encode some representative clips with --partition-log, which records for every
+inter mb the features known after its 16x16 search and the modes the full search
+chose, then build encoder/analyse_model.h from the logs:
+
+    x264 --preset slow --partition-log clip1.csv -o /dev/null clip1.y4m
+    tools/partition_model.py clip1.csv clip2.csv > encoder/analyse_model.h
+
+Each tree predicts whether a mode (the sub-16x16 partitions, intra) can win.  Its
+leaves are cut so that at most --max-miss of the mbs where the mode did win are
+ruled out.  The logs also record sub-8x8 partitions, but no model is trained for
+them: only veryslow and placebo search them, so logs from the usual presets have
+no sub-8x8 wins.
+"""
+
+import argparse
+import csv
+import sys
+
+MODELS = [
+    # name,    slice, label
+    ("p_split",  "P", "split"),
+    ("p_intra",  "P", "intra"),
+    ("b_split",  "B", "split"),
+    ("b_intra",  "B", "intra"),
+]
+LABELS = ("split", "sub8x8", "intra")
+
+
+def load(paths):
+    features = None
+    rows = {"P": [], "B": []}
+    for path in paths:
+        with open(path, newline="") as f:
+            reader = csv.reader(f)
+            header = next(reader)
+            names = header[1:-len(LABELS)]
+            if features is None:
+                features = names
+            elif names != features:
+                sys.exit("%s: features differ from the other logs" % path)
+            for r in reader:
+                rows[r[0]].append([int(v) for v in r[1:]])
+    return features, rows
+
+
+def thresholds(rows, nfeat, bins):
+    """Candidate split points: quantiles of each feature."""
+    cuts = []
+    for i in range(nfeat):
+        values = sorted(set(r[i] for r in rows))
+        if len(values) <= bins:
+            cuts.append(values[:-1])
+        else:
+            cuts.append(sorted(set(values[(k * len(values)) // bins] for k in range(1, bins))))
+    return cuts
+
+
+def gini(neg, pos):
+    n = neg + pos
+    return 0.0 if not n else 2.0 * neg * pos / n
+
+
+def grow(rows, label, cuts, depth, min_leaf):
+    pos = sum(r[label] for r in rows)
+    node = {"n": len(rows), "pos": pos}
+    if depth == 0 or pos == 0 or pos == len(rows) or len(rows) < 2 * min_leaf:
+        return node
+    best = None
+    parent = gini(len(rows) - pos, pos)
+    for f, fcuts in enumerate(cuts):
+        if not fcuts:
+            continue
+        # histogram of the node over the feature's cut points
+        hist = [[0, 0] for _ in range(len(fcuts) + 1)]
+        for r in rows:
+            v = r[f]
+            lo, hi = 0, len(fcuts)
+            while lo < hi:
+                mid = (lo + hi) // 2
+                if v <= fcuts[mid]:
+                    hi = mid
+                else:
+                    lo = mid + 1
+            hist[lo][r[label]] += 1
+        lneg = lpos = 0
+        for k, t in enumerate(fcuts):
+            lneg += hist[k][0]
+            lpos += hist[k][1]
+            rneg = len(rows) - pos - lneg
+            rpos = pos - lpos
+            if lneg + lpos < min_leaf or rneg + rpos < min_leaf:
+                continue
+            gain = parent - gini(lneg, lpos) - gini(rneg, rpos)
+            if gain > 0 and (best is None or gain > best[0]):
+                best = (gain, f, t)
+    if best is None:
+        return node
+    _, f, t = best
+    node["feature"] = f
+    node["threshold"] = t
+    node["left"] = grow([r for r in rows if r[f] <= t], label, cuts, depth - 1, min_leaf)
+    node["right"] = grow([r for r in rows if r[f] > t], label, cuts, depth - 1, min_leaf)
+    return node
+
+
+def leaves(node):
+    if "feature" not in node:
+        return [node]
+    return leaves(node["left"]) + leaves(node["right"])
+
+
+def decide(tree, max_miss):
+    """Rule out the leaves with the fewest wins per mb until the miss budget is spent."""
+    total = sum(l["pos"] for l in leaves(tree))
+    budget = max_miss * total
+    missed = skipped = 0
+    for l in leaves(tree):
+        l["try"] = 1
+    for l in sorted(leaves(tree), key=lambda l: (l["pos"] / l["n"], l["pos"])):
+        if missed + l["pos"] > budget:
+            break
+        l["try"] = 0
+        missed += l["pos"]
+        skipped += l["n"]
+    return skipped, missed, total
+
+
+def prune(node):
+    """Merge subtrees whose leaves all make the same decision."""
+    if "feature" not in node:
+        return node
+    node["left"] = prune(node["left"])
+    node["right"] = prune(node["right"])
+    l, r = node["left"], node["right"]
+    if "feature" not in l and "feature" not in r and l["try"] == r["try"]:
+        return {"n": node["n"], "pos": node["pos"], "try": l["try"]}
+    return node
+
+
+def flatten(tree):
+    nodes = []
+
+    def walk(node):
+        i = len(nodes)
+        nodes.append(None)
+        if "feature" not in node:
+            nodes[i] = (-1, node["try"], 0, 0)
+        else:
+            left = walk(node["left"])
+            right = walk(node["right"])
+            nodes[i] = (node["feature"], node["threshold"], left, right)
+        return i
+
+    walk(tree)
+    return nodes
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("logs", nargs="+", help="csv files written by x264 --partition-log")
+    parser.add_argument("--depth", type=int, default=6, help="maximum tree depth [%(default)s]")
+    parser.add_argument("--min-leaf", type=int, default=200, help="minimum mbs per leaf [%(default)s]")
+    parser.add_argument("--bins", type=int, default=32, help="candidate thresholds per feature [%(default)s]")
+    parser.add_argument("--max-miss", type=float, default=0.02,
+                        help="fraction of the mbs where a mode won that may be ruled out [%(default)s]")
+    args = parser.parse_args()
+
+    features, rows = load(args.logs)
+    nfeat = len(features)
+    out = ["/* Decision trees for --partition-model, generated by tools/partition_model.py; do not edit.",
+           " * features: %s */" % ", ".join(features)]
+    for name, slice_type, label in MODELS:
+        data = rows[slice_type]
+        col = nfeat + LABELS.index(label)
+        if data and any(r[col] for r in data):
+            tree = grow(data, col, thresholds(data, nfeat, args.bins), args.depth, args.min_leaf)
+            skipped, missed, total = decide(tree, args.max_miss)
+            tree = prune(tree)
+            sys.stderr.write("%-9s %7d mbs, %6d wins, skips %5.1f%% of mbs and %4.1f%% of wins\n"
+                             % (name, len(data), total, 100.0 * skipped / len(data), 100.0 * missed / max(total, 1)))
+        else:
+            # the mode was never searched (or never won) in the logs: don't rule it out
+            tree = {"try": 1}
+        nodes = flatten(tree)
+        out.append("")
+        out.append("static const x264_model_node_t partition_model_%s[%d] =" % (name, len(nodes)))
+        out.append("{")
+        for i in range(0, len(nodes), 4):
+            out.append("    " + " ".join("{ %2d, %6d, %3d, %3d }," % n for n in nodes[i:i+4]))
+        out.append("};")
+    print("\n".join(out))
+
+
+if __name__ == "__main__":
+    main()
@@ -160,6 +160,8 @@ typedef struct {
     hnd_t hout;
     FILE *qpfile;
     FILE *tcfile_out;
+    FILE *lookahead_stats;
+    int i_lookahead_mbs;
     double timebase_convert_multiplier;
     int i_pulldown;
 } cli_opt_t;
@@ -466,6 +468,8 @@ static int main_internal( int argc, char **argv )
         cli_output.close_file( opt.hout, 0, 0 );
     if( opt.tcfile_out )
         fclose( opt.tcfile_out );
+    if( opt.lookahead_stats )
+        fclose( opt.lookahead_stats );
     if( opt.qpfile )
         fclose( opt.qpfile );
 
@@ -814,6 +818,8 @@ static void help( x264_param_t *defaults, int longhelp )
     H2( "  -i, --min-keyint <integer>  Minimum GOP size [auto]\n" );
     H2( "      --no-scenecut           Disable adaptive I-frame decision\n" );
     H2( "      --scenecut <integer>    How aggressively to insert extra I-frames [%d]\n", defaults->i_scenecut_threshold );
+    H2( "      --scenecut-prefilter    Skip the scenecut cost check for frames whose\n"
+        "                                  histograms clearly show a cut or no cut\n" );
     H2( "      --intra-refresh         Use Periodic Intra Refresh instead of IDR frames\n" );
     H1( "  -b, --bframes <integer>     Number of B-frames between I and P [%d]\n", defaults->i_bframe );
     H1( "      --b-adapt <integer>     Adaptive B-frame decision method [%d]\n"
@@ -866,6 +872,12 @@ static void help( x264_param_t *defaults, int longhelp )
     H0( "  -B, --bitrate <integer>     Set bitrate (kbit/s)\n" );
     H0( "      --crf <float>           Quality-based VBR (%d-51) [%.1f]\n", 51 - QP_MAX_SPEC, defaults->rc.f_rf_constant );
     H1( "      --rc-lookahead <integer> Number of frames for frametype lookahead [%d]\n", defaults->rc.i_lookahead );
+    H2( "      --coarse-lookahead      Decide frametypes on a 1/4 resolution copy of each frame\n"
+        "                                  Faster lookahead for very high resolutions\n" );
+    H2( "      --incremental-lookahead <integer> Carry mb-tree propagation across lookahead windows\n"
+        "                                  instead of redoing the whole window for every decision.\n"
+        "                                  Changes are passed back through this many frames\n"
+        "                                  per window, which bounds the work per frame [0]\n" );
     H0( "      --vbv-maxrate <string> or <integer> Max local bitrate (kbit/s) [%d]\n"
         "                                  - auto_high444: Set the VBV maxrate to fit in the target level of High 4:4:4 Predictive Profile\n"
         "                                  - auto_high422: Set the VBV maxrate to fit in the target level of High 4:2:2 Profile\n"
@@ -959,11 +971,15 @@ static void help( x264_param_t *defaults, int longhelp )
         "                                  - hex: hexagonal search, radius 2\n"
         "                                  - umh: uneven multi-hexagon search\n"
         "                                  - esa: exhaustive search\n"
-        "                                  - tesa: hadamard exhaustive search (slow)\n" );
+        "                                  - tesa: hadamard exhaustive search (slow)\n"
+        "                                  - epzs: enhanced predictive zonal search\n" );
     else H1( "                                  - dia, hex, umh\n" );
     H2( "      --merange <integer>     Maximum motion vector search range [%d]\n", defaults->analyse.i_me_range );
     H2( "      --mvrange <integer>     Maximum motion vector length [-1 (auto)]\n" );
-    H2( "      --mvrange-thread <int>  Minimum buffer between threads [-1 (auto)]\n" );
+    H2( "      --mvrange-thread <int>  Minimum buffer between threads [-1 (auto)]\n"
+        "                                  Auto adapts it per frame to the motion seen by the lookahead\n" );
+    H2( "      --hash-me               Hash every 8x8 block of each reference and try exact\n"
+        "                              matches as motion search predictors (screen content)\n" );
     H1( "  -m, --subme <integer>       Subpixel motion estimation and mode decision [%d]\n", defaults->analyse.i_subpel_refine );
     H2( "                                  - 0: fullpel only (not recommended)\n"
         "                                  - 1: SAD mode decision, one qpel iteration\n"
@@ -993,6 +1009,19 @@ static void help( x264_param_t *defaults, int longhelp )
         "                                  - 1: enabled only on the final encode of a MB\n"
         "                                  - 2: enabled on all mode decisions\n", defaults->analyse.i_trellis );
     H2( "      --no-fast-pskip         Disables early SKIP detection on P-frames\n" );
+    H2( "      --static-skip           Skip macroblocks the lookahead finds static\n"
+        "                              without motion search or RD\n" );
+    H2( "      --dup-skip <integer>    Fast encoding of duplicate frames [%d]\n"
+        "                                  - 0: Disabled\n"
+        "                                  - 1: Code exact duplicates as skips\n"
+        "                                  - 2: Also reduce analysis of near-duplicates\n", defaults->analyse.i_dup_skip );
+    H2( "      --partition-model       Skip the partition and intra searches that a trained\n"
+        "                              model predicts won't win\n" );
+    H2( "      --partition-log <string> Log mb decisions for training that model\n" );
+    H2( "      --intra-gradient <integer> Only search the i4x4/i8x8 directions along the\n"
+        "                              strongest edges of each block [%d]\n"
+        "                                  - 0: Search all directions\n"
+        "                                  - 1-8: Number of directions kept besides DC\n", defaults->analyse.i_intra_gradient );
     H2( "      --no-dct-decimate       Disables coefficient thresholding on P-frames\n" );
     H1( "      --nr <integer>          Noise reduction [%d]\n", defaults->analyse.i_noise_reduction );
     H2( "\n" );
@@ -1105,8 +1134,15 @@ static void help( x264_param_t *defaults, int longhelp )
     H1( "      --demuxer-threads <integer> Force a specific number of threads for demuxer (lavf, ffms)\n" );
     H2( "      --lookahead-threads <integer> Force a specific number of lookahead threads\n" );
     H2( "      --sliced-threads        Low-latency but lower-efficiency threading\n" );
+    H2( "      --sliced-frames <integer> Encode this many frames in parallel with sliced threads,\n"
+        "                                  each split into slices across the remaining threads\n" );
     H2( "      --thread-input          Run Avisynth in its own thread\n" );
     H2( "      --sync-lookahead <integer> Number of buffer frames for threaded lookahead\n" );
+    H2( "      --entropy-thread        Run CABAC on a separate thread behind analysis\n"
+        "                                  Not used with VBV, slice-max-size or interlacing\n"
+        "                                  Loses compression with subme >= 6 or trellis\n" );
+    H2( "      --filter-thread         Deblock and hpel filter on a separate thread behind analysis\n"
+        "                                  Not used with sliced threads or interlacing\n" );
     H2( "      --non-deterministic     Slightly improve quality of SMP, at the cost of repeatability\n" );
     H2( "      --cpu-independent       Ensure exact reproducibility across different cpus,\n"
         "                                  as opposed to letting them select different algorithms\n" );
@@ -1124,6 +1160,9 @@ static void help( x264_param_t *defaults, int longhelp )
     H2( "      --no-fps-correction     Disable automatic NTSC fps correction\n" );
     H2( "      --tcfile-in <string>    Force timestamp generation with timecode file\n" );
     H2( "      --tcfile-out <string>   Output timecode v2 file from input timestamps\n" );
+    H2( "      --lookahead-stats <string> Only run the lookahead and write its frametypes,\n"
+        "                              costs and qp offsets to a file; nothing is encoded\n"
+        "                              and no output file is needed\n" );
     H2( "      --timebase <int/int>    Specify timebase numerator and denominator\n"
         "                 <integer>    Specify timebase numerator for input timecode file\n"
         "                              or specify timebase denominator for other input\n" );
@@ -1182,6 +1221,7 @@ typedef enum
     OPT_NO_FPS_CORRECTION,
     OPT_TCFILE_IN,
     OPT_TCFILE_OUT,
+    OPT_LOOKAHEAD_STATS,
     OPT_TIMEBASE,
     OPT_PULLDOWN,
     OPT_LOG_LEVEL,
@@ -1228,6 +1268,8 @@ static struct option long_options[] =
     { "keyint",      required_argument, NULL, 'I' },
     { "intra-refresh",     no_argument, NULL, 0 },
     { "scenecut",    required_argument, NULL, 0 },
+    { "scenecut-prefilter", no_argument, NULL, 0 },
+    { "no-scenecut-prefilter", no_argument, NULL, 0 },
     { "no-scenecut",       no_argument, NULL, 0 },
     { "nf",                no_argument, NULL, 0 },
     { "no-deblock",        no_argument, NULL, 0 },
@@ -1246,6 +1288,9 @@ static struct option long_options[] =
     { "qpstep",      required_argument, NULL, 0 },
     { "crf",         required_argument, NULL, 0 },
     { "rc-lookahead",required_argument, NULL, 0 },
+    { "coarse-lookahead",  no_argument, NULL, 0 },
+    { "incremental-lookahead", required_argument, NULL, 0 },
+    { "no-coarse-lookahead", no_argument, NULL, 0 },
     { "ref",         required_argument, NULL, 'r' },
     { "asm",         required_argument, NULL, 0 },
     { "no-asm",            no_argument, NULL, 0 },
@@ -1273,6 +1318,7 @@ static struct option long_options[] =
     { "merange",     required_argument, NULL, 0 },
     { "mvrange",     required_argument, NULL, 0 },
     { "mvrange-thread", required_argument, NULL, 0 },
+    { "hash-me",           no_argument, NULL, 0 },
     { "subme",       required_argument, NULL, 'm' },
     { "psy-rd",      required_argument, NULL, 0 },
     { "no-psy",            no_argument, NULL, 0 },
@@ -1285,6 +1331,11 @@ static struct option long_options[] =
     { "trellis",     required_argument, NULL, 't' },
     { "fast-pskip",        no_argument, NULL, 0 },
     { "no-fast-pskip",     no_argument, NULL, 0 },
+    { "static-skip",       no_argument, NULL, 0 },
+    { "dup-skip",    required_argument, NULL, 0 },
+    { "partition-model",   no_argument, NULL, 0 },
+    { "intra-gradient",    required_argument, NULL, 0 },
+    { "partition-log", required_argument, NULL, 0 },
     { "no-dct-decimate",   no_argument, NULL, 0 },
     { "aq-strength", required_argument, NULL, 0 },
     { "aq-mode",     required_argument, NULL, 0 },
@@ -1316,6 +1367,7 @@ static struct option long_options[] =
     { "lookahead-threads", required_argument, NULL, 0 },
     { "sliced-threads",    no_argument, NULL, 0 },
     { "no-sliced-threads", no_argument, NULL, 0 },
+    { "sliced-frames",     required_argument, NULL, 0 },
     { "slice-max-size",    required_argument, NULL, 0 },
     { "slice-max-mbs",     required_argument, NULL, 0 },
     { "slice-min-mbs",     required_argument, NULL, 0 },
@@ -1323,6 +1375,10 @@ static struct option long_options[] =
     { "slices-max",        required_argument, NULL, 0 },
     { "thread-input",      no_argument, NULL, OPT_THREAD_INPUT },
     { "sync-lookahead",    required_argument, NULL, 0 },
+    { "entropy-thread",    no_argument, NULL, 0 },
+    { "no-entropy-thread", no_argument, NULL, 0 },
+    { "filter-thread",     no_argument, NULL, 0 },
+    { "no-filter-thread",  no_argument, NULL, 0 },
     { "non-deterministic", no_argument, NULL, 0 },
     { "cpu-independent",   no_argument, NULL, 0 },
     { "psnr",              no_argument, NULL, 0 },
@@ -1363,6 +1419,7 @@ static struct option long_options[] =
     { "no-fps-correction", no_argument, NULL, OPT_NO_FPS_CORRECTION },
     { "tcfile-in",   required_argument, NULL, OPT_TCFILE_IN },
     { "tcfile-out",  required_argument, NULL, OPT_TCFILE_OUT },
+    { "lookahead-stats", required_argument, NULL, OPT_LOOKAHEAD_STATS },
     { "timebase",    required_argument, NULL, OPT_TIMEBASE },
     { "pic-struct",        no_argument, NULL, 0 },
     { "crop-rect",   required_argument, NULL, 0 },
@@ -1766,6 +1823,11 @@ static int parse( int argc, char **argv, x264_param_t *param, cli_opt_t *opt )
                 opt->tcfile_out = x264_fopen( optarg, "wb" );
                 FAIL_IF_ERROR( !opt->tcfile_out, "can't open `%s'\n", optarg );
                 break;
+            case OPT_LOOKAHEAD_STATS:
+                opt->lookahead_stats = x264_fopen( optarg, "wb" );
+                FAIL_IF_ERROR( !opt->lookahead_stats, "can't open `%s'\n", optarg );
+                param->b_lookahead_only = 1;
+                break;
             case OPT_TIMEBASE:
                 input_opt.timebase = optarg;
                 break;
@@ -1851,12 +1913,21 @@ generic_option:
         return -1;
 
     /* Get the file name */
-    FAIL_IF_ERROR( optind > argc - 1 || !output_filename, "No %s file. Run x264 --help for a list of options.\n",
+    FAIL_IF_ERROR( optind > argc - 1 || (!output_filename && !opt->lookahead_stats), "No %s file. Run x264 --help for a list of options.\n",
                    optind > argc - 1 ? "input" : "output" );
 
-    if( select_output( muxer, output_filename, param ) )
-        return -1;
-    FAIL_IF_ERROR( cli_output.open_file( output_filename, &opt->hout, &output_opt ), "could not open output file `%s'\n", output_filename );
+    /* Nothing is encoded in lookahead-only mode, so there is no output file. */
+    if( opt->lookahead_stats )
+    {
+        if( output_filename )
+            x264_cli_log( "x264", X264_LOG_WARNING, "--lookahead-stats: ignoring output file `%s'\n", output_filename );
+    }
+    else
+    {
+        if( select_output( muxer, output_filename, param ) )
+            return -1;
+        FAIL_IF_ERROR( cli_output.open_file( output_filename, &opt->hout, &output_opt ), "could not open output file `%s'\n", output_filename );
+    }
 
     input_filename = argv[optind++];
     video_info_t info = {0};
@@ -2097,7 +2168,22 @@ static void parse_qpfile( cli_opt_t *opt, x264_picture_t *pic, int i_frame )
     }
 }
 
-static int encode_frame( x264_t *h, hnd_t hout, x264_picture_t *pic, int64_t *last_dts )
+static int write_lookahead_stats( cli_opt_t *opt, x264_picture_t *pic_out )
+{
+    static const char type_chars[] = { 'I', 'i', 'P', 'B', 'b' };
+    float qp_offset = 0;
+    if( pic_out->prop.lookahead_qp_offsets )
+    {
+        for( int i = 0; i < opt->i_lookahead_mbs; i++ )
+            qp_offset += pic_out->prop.lookahead_qp_offsets[i];
+        qp_offset /= opt->i_lookahead_mbs;
+    }
+    return fprintf( opt->lookahead_stats, "%"PRId64" %c %d %d %.4f %.4f\n", pic_out->i_pts,
+                    type_chars[pic_out->i_type - X264_TYPE_IDR], pic_out->prop.i_lookahead_cost,
+                    pic_out->prop.i_lookahead_intra_cost, pic_out->prop.f_lookahead_intra_mbs, qp_offset );
+}
+
+static int encode_frame( x264_t *h, cli_opt_t *opt, x264_picture_t *pic, int64_t *last_dts )
 {
     x264_picture_t pic_out;
     x264_nal_t *nal;
@@ -2108,9 +2194,14 @@ static int encode_frame( x264_t *h, hnd_t hout, x264_picture_t *pic, int64_t *la
 
     FAIL_IF_ERROR( i_frame_size < 0, "x264_encoder_encode failed\n" );
 
-    if( i_frame_size )
+    if( opt->lookahead_stats && pic_out.i_type != X264_TYPE_AUTO )
+    {
+        i_frame_size = write_lookahead_stats( opt, &pic_out );
+        *last_dts = pic_out.i_dts;
+    }
+    else if( i_frame_size )
     {
-        i_frame_size = cli_output.write_frame( hout, nal[0].p_payload, i_frame_size, &pic_out );
+        i_frame_size = cli_output.write_frame( opt->hout, nal[0].p_payload, i_frame_size, &pic_out );
         *last_dts = pic_out.i_dts;
     }
 
@@ -2253,7 +2344,7 @@ static int encode( x264_param_t *param, cli_opt_t *opt )
 
     x264_encoder_parameters( h, param );
 
-    FAIL_IF_ERROR2( cli_output.set_param( opt->hout, param ), "can't set outfile param\n" );
+    FAIL_IF_ERROR2( opt->hout && cli_output.set_param( opt->hout, param ), "can't set outfile param\n" );
 
     i_start = x264_mdate();
 
@@ -2262,7 +2353,13 @@ static int encode( x264_param_t *param, cli_opt_t *opt )
     FAIL_IF_ERROR2( ticks_per_frame < 1 && !param->b_vfr_input, "ticks_per_frame invalid: %"PRId64"\n", ticks_per_frame );
     ticks_per_frame = X264_MAX( ticks_per_frame, 1 );
 
-    if( !param->b_repeat_headers )
+    if( opt->lookahead_stats )
+    {
+        int mb_height = param->b_interlaced ? 2 * ((param->i_height + 31) / 32) : (param->i_height + 15) / 16;
+        opt->i_lookahead_mbs = (param->i_width + 15) / 16 * mb_height;
+        fprintf( opt->lookahead_stats, "# pts type cost intra_cost intra_mbs qp_offset\n" );
+    }
+    else if( !param->b_repeat_headers )
     {
         // Write SPS/PPS/SEI
         x264_nal_t *headers;
@@ -2327,7 +2424,7 @@ static int encode( x264_param_t *param, cli_opt_t *opt )
             parse_qpfile( opt, &pic, i_frame + opt->i_seek );
 
         prev_dts = last_dts;
-        i_frame_size = encode_frame( h, opt->hout, &pic, &last_dts );
+        i_frame_size = encode_frame( h, opt, &pic, &last_dts );
         if( i_frame_size < 0 )
         {
             b_ctrl_c = 1; /* lie to exit the loop */
@@ -2352,7 +2449,7 @@ static int encode( x264_param_t *param, cli_opt_t *opt )
     while( !b_ctrl_c && x264_encoder_delayed_frames( h ) )
     {
         prev_dts = last_dts;
-        i_frame_size = encode_frame( h, opt->hout, NULL, &last_dts );
+        i_frame_size = encode_frame( h, opt, NULL, &last_dts );
         if( i_frame_size < 0 )
         {
             b_ctrl_c = 1; /* lie to exit the loop */
@@ -2401,10 +2498,19 @@ fail:
     if( b_ctrl_c )
         x264_cli_printf( X264_LOG_INFO, "aborted at input frame %d, output frame %d\n", opt->i_seek + i_frame, i_frame_output );
 
-    cli_output.close_file( opt->hout, largest_pts, second_largest_pts );
+    if( opt->hout )
+        cli_output.close_file( opt->hout, largest_pts, second_largest_pts );
     opt->hout = NULL;
 
-    if( i_frame_output > 0 )
+    if( i_frame_output > 0 && opt->lookahead_stats )
+    {
+        double fps = (double)i_frame_output * (double)1000000 /
+                     (double)( i_end - i_start );
+
+        x264_cli_printf( X264_LOG_INFO, "analysed %d frames, %.*f fps\n",
+                         i_frame_output, fps > 9.95 ? 2 : fps > 0.995 ? 3 : 4, fps );
+    }
+    else if( i_frame_output > 0 )
     {
         double fps = (double)i_frame_output * (double)1000000 /
                      (double)( i_end - i_start );
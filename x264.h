@@ -45,7 +45,7 @@ extern "C" {
 
 #include "x264_config.h"
 
-#define X264_BUILD 155
+#define X264_BUILD 156
 
 /* Application developers planning to link against a shared library version of
  * libx264 from a Microsoft Visual Studio or similar development environment
@@ -179,6 +179,7 @@ typedef struct x264_nal_t
 #define X264_ME_UMH                  2
 #define X264_ME_ESA                  3
 #define X264_ME_TESA                 4
+#define X264_ME_EPZS                 5
 #define X264_CQM_FLAT                0
 #define X264_CQM_JVT                 1
 #define X264_CQM_CUSTOM              2
@@ -205,7 +206,7 @@ typedef struct x264_nal_t
 #define X264_LEVEL_IDC_AUTO          (-1)
 
 static const char * const x264_direct_pred_names[] = { "none", "spatial", "temporal", "auto", 0 };
-static const char * const x264_motion_est_names[] = { "dia", "hex", "umh", "esa", "tesa", 0 };
+static const char * const x264_motion_est_names[] = { "dia", "hex", "umh", "esa", "tesa", "epzs", 0 };
 static const char * const x264_b_pyramid_names[] = { "none", "strict", "normal", 0 };
 static const char * const x264_overscan_names[] = { "undef", "show", "crop", 0 };
 static const char * const x264_vidformat_names[] = { "component", "pal", "ntsc", "secam", "mac", "undef", 0 };
@@ -349,9 +350,13 @@ typedef struct x264_param_t
     int         i_threads;           /* encode multiple frames in parallel */
     int         i_lookahead_threads; /* multiple threads for lookahead analysis */
     int         b_sliced_threads;  /* Whether to use slice-based threading. */
+    int         i_sliced_frames; /* with sliced threads: frames encoded in parallel, each split across i_threads/i_sliced_frames slices */
     int         b_deterministic; /* whether to allow non-deterministic optimizations when threaded */
     int         b_cpu_independent; /* force canonical behavior rather than cpu-dependent optimal algorithms */
     int         i_sync_lookahead; /* threaded lookahead buffer */
+    int         b_entropy_thread; /* run CABAC on a separate thread, trailing analysis by a few rows */
+    int         b_filter_thread; /* deblock, hpel filter and measure psnr/ssim on a separate thread behind analysis */
+    int         b_lookahead_only; /* only run the lookahead: no bitstream, its results are returned in x264_picture_t.prop */
 
     /* Video Properties */
     int         i_width;
@@ -396,6 +401,7 @@ typedef struct x264_param_t
     int         i_keyint_max;       /* Force an IDR keyframe at this interval */
     int         i_keyint_min;       /* Scenecuts closer together than this are coded as I, not IDR. */
     int         i_scenecut_threshold; /* how aggressively to insert extra I frames */
+    int         b_scenecut_prefilter; /* Decide obvious scenecuts and non-scenecuts from frame histograms, without the lookahead costs */
     int         b_intra_refresh;    /* Whether or not to use periodic intra refresh instead of IDR frames. */
 
     int         i_bframe;   /* how many b-frame between 2 references pictures */
@@ -452,12 +458,16 @@ typedef struct x264_param_t
         int          i_me_method; /* motion estimation algorithm to use (X264_ME_*) */
         int          i_me_range; /* integer pixel motion estimation search range (from predicted mv) */
         int          i_mv_range; /* maximum length of a mv (in pixels). -1 = auto, based on level */
-        int          i_mv_range_thread; /* minimum space between threads. -1 = auto, based on number of threads. */
+        int          i_mv_range_thread; /* minimum space between threads. -1 = auto, based on number of threads and lookahead motion. */
+        int          b_hash_me; /* use exact block matches found in a hash of each reference as mv predictors */
         int          i_subpel_refine; /* subpixel motion estimation quality */
         int          b_chroma_me; /* chroma ME for subpel and mode decision in P-frames */
         int          b_mixed_references; /* allow each mb partition to have its own reference number */
         int          i_trellis;  /* trellis RD quantization */
         int          b_fast_pskip; /* early SKIP detection on P-frames */
+        int          b_partition_model; /* skip partition and intra searches a trained decision model rules out */
+        char         *psz_partition_log; /* filename (in UTF-8) to log mb decisions to, for training that model */
+        int          i_intra_gradient; /* i4x4/i8x8 edge directions to search, ranked by a Sobel pre-pass; 0 = all */
         int          b_dct_decimate; /* transform coefficient thresholding on P-frames */
         int          i_noise_reduction; /* adaptive pseudo-deadzone */
         int          i_fgo; /* psy film grain optimization */
@@ -467,6 +477,8 @@ typedef struct x264_param_t
 
         int          b_mb_info;            /* Use input mb_info data in x264_picture_t */
         int          b_mb_info_update; /* Update the values in mb_info according to the results of encoding. */
+        int          b_static_skip;        /* Force skip on macroblocks the lookahead finds static */
+        int          i_dup_skip;           /* 1: encode frames identical to their references as skips, 2: also reduce analysis of near-duplicates */
 
         /* the deadzone size that will be used in luma quantization */
         int          i_luma_deadzone[2]; /* {inter, intra} */
@@ -506,6 +518,9 @@ typedef struct x264_param_t
         float       f_fade_compensate; /* Give more bits to fades. */
         int         b_mb_tree;      /* Macroblock-tree ratecontrol. */
         int         i_lookahead;
+        int         b_coarse_lookahead; /* Decide frametypes on a 1/4 resolution plane; the 1/2 resolution one is then only used by mbtree and VBV */
+        int         i_incremental_lookahead; /* Carry mbtree propagation across lookahead windows, passing changes back
+                                              * through this many frames per window (0 = propagate the whole window each time) */
 
         /* 2pass */
         int         b_stat_write;   /* Enable stat writing in psz_stat_out */
@@ -867,6 +882,15 @@ typedef struct x264_image_properties_t
 
     /* Out: Average effective CRF of the encoded frame */
     double f_crf_avg;
+
+    /* Out: lookahead results for the frame (if x264_param_t.b_lookahead_only is set).
+     *      Costs are SATD estimates on the half-resolution plane. */
+    int i_lookahead_cost;        /* as the frame type it was given */
+    int i_lookahead_intra_cost;  /* as an I-frame */
+    float f_lookahead_intra_mbs; /* fraction of blocks coded intra, as the frame type it was given; -1 for B-frames */
+    /* Out: the quantizer offset of each macroblock from mbtree and AQ (if x264_param_t.b_lookahead_only
+     *      is set), or NULL if neither is enabled.  Valid until the next call to x264_encoder_encode. */
+    float *lookahead_qp_offsets;
 } x264_image_properties_t;
 
 typedef struct x264_picture_t